@@ -0,0 +1,191 @@
+/*
+This file is part of Photo Viewport.
+	Photo Viewport is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	Photo Viewport is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with Photo Viewport.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "AnimationPlayer.h"
+#include <atomic>
+
+struct AnimationPlayer::Decoder
+{
+	// A player has at most one frame decoding at a time, so only one task is ever using this at once.
+	// It's shared with the task, rather than owned by the player, so the task never has to reach into the player for it.
+	Slide slide;
+	std::unique_ptr<QBuffer> buffer;
+	std::unique_ptr<QImageReader> reader;
+	std::atomic<bool> stopped{ false };
+};
+
+class AnimationPlayer::Task : public QRunnable
+{
+public:
+	Task(AnimationPlayer *player, const std::shared_ptr<Decoder> &decoder)
+		: player(player), decoder(decoder)
+	{
+	}
+
+	void run() override
+	{
+		// Frames of an animation are usually drawn on top of the ones before them, so they have to be read in order,
+		// and going back to the first frame means starting the reader over from the beginning.
+		Trace::Scope trace("decodeFrame");
+		Decoder &state = *decoder.get();
+		if (state.stopped)
+			return;
+		if (!state.reader)
+		{
+			state.buffer = std::make_unique<QBuffer>();
+			state.reader = std::make_unique<QImageReader>();
+			state.slide.readerSetup(*state.reader.get(), *state.buffer.get());
+		}
+
+		Frame frame;
+		frame.image = Slide::paintReady(state.reader.get()->read());
+		frame.delayMs = state.reader.get()->nextImageDelay();
+		const bool frameLast = frame.image.isNull() || !state.reader.get()->canRead();
+		if (frameLast)
+		{
+			state.reader.reset();
+			state.buffer.reset();
+		}
+
+		AnimationPlayer *playerTarget = player;
+		QMetaObject::invokeMethod(player, [playerTarget, frame, frameLast]() {
+			playerTarget->frameDecoded(frame, frameLast);
+		}, Qt::QueuedConnection);
+	}
+
+	AnimationPlayer *player;
+	std::shared_ptr<Decoder> decoder;
+};
+
+AnimationPlayer::AnimationPlayer(const Slide &slide, QObject *parent)
+	: QObject(parent), id(slide.id), decoder(std::make_shared<Decoder>())
+{
+	decoder.get()->slide = slide;
+	threadPool.setMaxThreadCount(1);
+	frameTimer.setSingleShot(true);
+	connect(&frameTimer, &QTimer::timeout, this, &AnimationPlayer::frameNext);
+}
+
+AnimationPlayer::~AnimationPlayer()
+{
+	// A frame that's already decoding is waited for, since it calls back to this player when it's done;
+	// the result it posts is dropped along with the player. One that hasn't started yet never will.
+	decoder.get()->stopped = true;
+	threadPool.clear();
+	threadPool.waitForDone();
+}
+
+quint64 AnimationPlayer::slideId() const
+{
+	return id;
+}
+
+QPixmap AnimationPlayer::frame() const
+{
+	return frameCurrent;
+}
+
+void AnimationPlayer::start()
+{
+	playing = true;
+	if (!frameTimer.isActive())
+		frameNext();
+}
+
+void AnimationPlayer::stop()
+{
+	playing = false;
+	frameTimer.stop();
+}
+
+
+// private
+
+void AnimationPlayer::frameNext()
+{
+	// A still image (only one frame) has nothing more to show once its frame is up.
+	if (!playing || (frameLoopComplete && frameLoop.size() <= 1 && frameAhead.empty()))
+		return;
+
+	if (!frameAhead.empty())
+	{
+		const Frame frame = frameAhead.front();
+		frameAhead.pop_front();
+		frameShow(frame);
+		frameRequest();
+	}
+	else if (frameLoopComplete)
+	{
+		frameShow(frameLoop[frameLoopIndex]);
+		frameLoopIndex = (frameLoopIndex + 1) % int(frameLoop.size());
+	}
+	else
+	{
+		// Decoding has fallen behind, so the frame is shown as soon as it arrives instead of on the timer.
+		frameWaiting = true;
+		frameRequest();
+	}
+}
+
+void AnimationPlayer::frameShow(const Frame &frame)
+{
+	// Like browsers do, we treat very short delays (which some GIFs are written with) as 100 ms, rather than spinning through frames.
+	frameWaiting = false;
+	frameCurrent = QPixmap::fromImage(frame.image);
+	emit frameChanged();
+	frameTimer.start(frame.delayMs > 10 ? frame.delayMs : 100);
+}
+
+void AnimationPlayer::frameRequest()
+{
+	if (decoding || frameLoopComplete || int(frameAhead.size()) >= frameAheadMax)
+		return;
+
+	decoding = true;
+	threadPool.start(new Task(this, decoder));
+}
+
+void AnimationPlayer::frameDecoded(const Frame &frame, const bool frameLast)
+{
+	// The first time through, we also keep every frame, for as long as they all fit in the budget.
+	// Once they don't, the kept frames are let go, and the animation is decoded afresh each time round.
+	decoding = false;
+	if (!frame.image.isNull())
+	{
+		if (frameLoopBytes >= 0)
+		{
+			frameLoopBytes += frame.image.sizeInBytes();
+			if (frameLoopBytes <= frameLoopBudget)
+				frameLoop.push_back(frame);
+			else
+			{
+				frameLoop.clear();
+				frameLoop.shrink_to_fit();
+				frameLoopBytes = -1;
+			}
+		}
+		frameAhead.push_back(frame);
+	}
+	if (frameLast)
+	{
+		if (frameLoopBytes >= 0)
+			frameLoopComplete = true;
+		frameLoopBytes = -1;
+	}
+
+	if (frameWaiting && !frameAhead.empty())
+		frameNext();
+	else
+		frameRequest();
+}
@@ -0,0 +1,78 @@
+/*
+This file is part of Photo Viewport.
+	Photo Viewport is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	Photo Viewport is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with Photo Viewport.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <memory>
+#include <deque>
+#include <vector>
+#include <QObject>
+#include <QTimer>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QImage>
+#include <QPixmap>
+#include "Slide.h"
+#include "Trace.h"
+
+// Plays back an animated slide (e.g. a GIF), decoding its frames one at a time, a little ahead of when they're shown.
+// Only a few decoded frames are held at once, so a long animation costs no more memory than a short one.
+// The exception is an animation small enough that all of its frames fit within a budget, which is kept whole
+// after the first time through, so it loops without decoding anything more.
+// Frames are shown on a timer, for as long as each frame asks for. A player only exists for the slide on screen;
+// destroying it stops playback, drops any frame that hasn't started decoding, and waits for one that has,
+// since the task reports back to the player. Frames are decoded on the player's own thread, so that wait is never
+// behind anything else's work (the resampler's helpers run on the global pool, for one).
+class AnimationPlayer : public QObject
+{
+	Q_OBJECT
+
+public:
+	AnimationPlayer(const Slide &slide, QObject *parent = Q_NULLPTR);
+	~AnimationPlayer();
+	quint64 slideId() const;
+	QPixmap frame() const;
+	void start();
+	void stop();
+
+signals:
+	void frameChanged();
+
+private:
+	struct Frame
+	{
+		QImage image;
+		int delayMs;
+	};
+	struct Decoder;
+	class Task;
+	const int frameAheadMax = 3;
+	const qint64 frameLoopBudget = qint64(64) * 1024 * 1024;
+	const quint64 id;
+	std::shared_ptr<Decoder> decoder;
+	QThreadPool threadPool;
+	QTimer frameTimer;
+	QPixmap frameCurrent;
+	std::deque<Frame> frameAhead;
+	std::vector<Frame> frameLoop;
+	qint64 frameLoopBytes = 0;
+	bool frameLoopComplete = false;
+	int frameLoopIndex = 0;
+	bool playing = false;
+	bool frameWaiting = true;
+	bool decoding = false;
+	void frameNext();
+	void frameShow(const Frame &frame);
+	void frameRequest();
+	void frameDecoded(const Frame &frame, const bool frameLast);
+};
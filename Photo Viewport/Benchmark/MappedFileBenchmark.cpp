@@ -0,0 +1,161 @@
+/*
+This file is part of Photo Viewport.
+	Photo Viewport is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	Photo Viewport is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with Photo Viewport.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Compares decoding large files through a memory mapping (see MappedFile) with reading them by path, on a corpus
+// of large JPEGs totalling 50 to 200 MB. Peak resident memory is per process, so each way is run in a child process
+// of its own (this same executable, with --mode), which opens every file as a slide and decodes it twice: once at
+// screen size, as it's first shown, and again at full resolution, as zooming in would. Reports both as JSON.
+//
+// Usage: mapped_file_benchmark [--corpus-mb N] [--corpus DIR] [--output FILE]
+
+#include <algorithm>
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QProcess>
+#include <QRandomGenerator>
+#include "../Slide.h"
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#endif
+
+static qint64 peakRssBytes()
+{
+#ifdef Q_OS_UNIX
+	// Linux reports ru_maxrss in kilobytes.
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) == 0)
+		return qint64(usage.ru_maxrss) * 1024;
+#endif
+	return -1;
+}
+
+static QStringList corpusBuild(const QString &dir, const qint64 bytesTarget)
+{
+	// A gradient with heavy noise over it, so each 24 megapixel JPEG comes out at around 16 MB, well past the size we start mapping files at.
+	QRandomGenerator random(12345);
+	QStringList pathList;
+	qint64 bytesTotal = 0;
+	for (int index = 0; bytesTotal < bytesTarget; index++)
+	{
+		const QString path = QString("%1/large-%2.jpg").arg(dir).arg(index);
+		if (!QFile::exists(path))
+		{
+			QImage image(QSize(6000, 4000), QImage::Format_RGB32);
+			for (int y = 0; y < image.height(); y++)
+			{
+				QRgb *line = reinterpret_cast<QRgb*>(image.scanLine(y));
+				for (int x = 0; x < image.width(); x++)
+				{
+					const int noise = int(random.bounded(64)) - 32;
+					line[x] = qRgb(
+						qBound(0, x * 255 / image.width() + noise, 255),
+						qBound(0, y * 255 / image.height() + noise, 255),
+						qBound(0, (x * 255 / image.width() + y * 255 / image.height()) / 2 + noise, 255)
+					);
+				}
+			}
+			image.save(path, "JPG", 95);
+		}
+		bytesTotal += QFileInfo(path).size();
+		pathList.append(path);
+	}
+	return pathList;
+}
+
+static QJsonObject modeRun(const QStringList &pathList, const bool mapping)
+{
+	// The slides are all kept, as the slideshow keeps them, so whatever each one holds on to between decodes counts.
+	MappedFile::setMapBytesMin(mapping ? 0 : -1);
+	std::vector<Slide> slideList;
+	QElapsedTimer timer;
+	timer.start();
+	for (const QString &path : pathList)
+	{
+		slideList.push_back(Slide::fromFile(path));
+		slideList.back().decode(2);
+	}
+	const double screenMs = timer.nsecsElapsed() / 1e6;
+	timer.restart();
+	for (const Slide &slide : slideList)
+		slide.decode(0);
+	const double fullMs = timer.nsecsElapsed() / 1e6;
+
+	QJsonObject result;
+	result["mapping"] = mapping;
+	result["load_screen_ms"] = screenMs;
+	result["load_full_ms"] = fullMs;
+	result["load_screen_ms_per_image"] = screenMs / pathList.size();
+	result["load_full_ms_per_image"] = fullMs / pathList.size();
+	result["peak_rss_bytes"] = double(peakRssBytes());
+	return result;
+}
+
+int main(int argc, char *argv[])
+{
+	QCoreApplication a(argc, argv);
+
+	QCommandLineParser parser;
+	parser.addOption(QCommandLineOption("corpus-mb", "Total size of the corpus, from 50 to 200 MB.", "N", "120"));
+	parser.addOption(QCommandLineOption("corpus", "Directory to generate (or reuse) the corpus in.", "DIR"));
+	parser.addOption(QCommandLineOption("mode", "Run one way only, in this process (mapped or read), and report it.", "MODE"));
+	parser.addOption(QCommandLineOption("output", "File to write the JSON report to, instead of stdout.", "FILE"));
+	parser.addHelpOption();
+	parser.process(a);
+
+	QTemporaryDir corpusTemp;
+	const QString corpusDir = parser.isSet("corpus") ? parser.value("corpus") : corpusTemp.path();
+	QDir().mkpath(corpusDir);
+	const qint64 corpusMB = qBound(50, parser.value("corpus-mb").toInt(), 200);
+	const QStringList pathList = corpusBuild(corpusDir, corpusMB * 1024 * 1024);
+
+	QJsonObject report;
+	if (parser.isSet("mode"))
+		report = modeRun(pathList, parser.value("mode") == "mapped");
+	else
+	{
+		// The children reuse the corpus we just built, so both find it in the page cache.
+		qint64 bytesTotal = 0;
+		for (const QString &path : pathList)
+			bytesTotal += QFileInfo(path).size();
+		report["corpus_images"] = pathList.size();
+		report["corpus_bytes"] = double(bytesTotal);
+		for (const QString mode : { QString("mapped"), QString("read") })
+		{
+			QProcess child;
+			child.start(QCoreApplication::applicationFilePath(), { "--mode", mode, "--corpus", corpusDir, "--corpus-mb", QString::number(corpusMB) });
+			if (!child.waitForFinished(-1) || child.exitCode() != 0)
+				return 1;
+			report[mode] = QJsonDocument::fromJson(child.readAllStandardOutput()).object();
+		}
+	}
+
+	const QByteArray json = QJsonDocument(report).toJson(QJsonDocument::Indented);
+	if (parser.isSet("output"))
+	{
+		QFile file(parser.value("output"));
+		if (!file.open(QIODevice::WriteOnly))
+			return 1;
+		file.write(json);
+	}
+	else
+		fwrite(json.constData(), 1, size_t(json.size()), stdout);
+	return 0;
+}
@@ -0,0 +1,306 @@
+/*
+This file is part of Photo Viewport.
+	Photo Viewport is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	Photo Viewport is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with Photo Viewport.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Checks NetworkLoader against a local HTTP stand-in (a QTcpServer answering on the loopback interface), so nothing goes out
+// to the real network: a slow download has to produce previews before it finishes, and a second load of the same url
+// while the first is under way has to share its request; a cached response has to be revalidated with its ETag,
+// and come back from the cache when the server says it hasn't changed; and a missing image or a connection dropped
+// part way through the body has to be reported as a failure with no data. Reports as JSON, and exits with a non-zero
+// status if any check fails, so it can gate a build.
+//
+// Usage: network_loader_test [--output FILE]
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QFile>
+#include <QBuffer>
+#include <QPointer>
+#include <QTimer>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QRandomGenerator>
+#include "../NetworkLoader.h"
+#include "../Slide.h"
+
+class HttpStandIn
+{
+public:
+	// What the stand-in sends back for a path. The body can be sent a piece at a time, with a pause between pieces,
+	// like a slow connection would; or cut off half way, with the connection closed under it.
+	// With an ETag, a request that already has it (If-None-Match) is answered with 304 Not Modified and no body.
+	struct Route
+	{
+		QByteArray body;
+		QByteArray contentType;
+		QByteArray etag;
+		QByteArray cacheControl = "no-store";
+		int status = 200;
+		int pieces = 1;
+		int pieceDelayMs = 0;
+		bool truncate = false;
+	};
+
+	HttpStandIn()
+	{
+		server.listen(QHostAddress::LocalHost);
+		QObject::connect(&server, &QTcpServer::newConnection, [this]() {
+			while (QTcpSocket *socket = server.nextPendingConnection())
+				accept(socket);
+		});
+	}
+
+	bool isListening() const
+	{
+		return server.isListening();
+	}
+
+	QUrl url(const QByteArray &path) const
+	{
+		return QUrl(QString("http://127.0.0.1:%1%2").arg(server.serverPort()).arg(QString::fromLatin1(path)));
+	}
+
+	void route(const QByteArray &path, const Route &route)
+	{
+		routeList[path] = route;
+	}
+
+	int requests(const QByteArray &path) const
+	{
+		auto found = requestCount.find(path);
+		return found != requestCount.end() ? found->second : 0;
+	}
+
+	int notModified(const QByteArray &path) const
+	{
+		auto found = notModifiedCount.find(path);
+		return found != notModifiedCount.end() ? found->second : 0;
+	}
+
+private:
+	QTcpServer server;
+	std::map<QByteArray, Route> routeList;
+	std::map<QByteArray, int> requestCount;
+	std::map<QByteArray, int> notModifiedCount;
+
+	void accept(QTcpSocket *socket)
+	{
+		// Every response closes its connection, so there's only ever one request to read per socket.
+		QObject::connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+		auto request = std::make_shared<QByteArray>();
+		QObject::connect(socket, &QTcpSocket::readyRead, socket, [this, socket, request]() {
+			if (request->contains("\r\n\r\n"))
+				return;
+			request->append(socket->readAll());
+			if (request->contains("\r\n\r\n"))
+				answer(socket, *request);
+		});
+	}
+
+	void answer(QTcpSocket *socket, const QByteArray &request)
+	{
+		const QList<QByteArray> lineList = request.left(request.indexOf("\r\n\r\n")).split('\n');
+		const QList<QByteArray> requestLine = lineList.first().trimmed().split(' ');
+		const QByteArray path = requestLine.size() > 1 ? requestLine[1] : QByteArray();
+		QByteArray ifNoneMatch;
+		for (const QByteArray &line : lineList)
+			if (line.toLower().startsWith("if-none-match:"))
+				ifNoneMatch = line.mid(line.indexOf(':') + 1).trimmed();
+		requestCount[path]++;
+
+		auto found = routeList.find(path);
+		if (found == routeList.end())
+		{
+			socket->write("HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+			socket->disconnectFromHost();
+			return;
+		}
+		const Route &route = found->second;
+		QByteArray header;
+		if (!route.etag.isEmpty() && ifNoneMatch == route.etag)
+		{
+			notModifiedCount[path]++;
+			header = "HTTP/1.1 304 Not Modified\r\nETag: " + route.etag + "\r\nCache-Control: " + route.cacheControl + "\r\nConnection: close\r\n\r\n";
+			socket->write(header);
+			socket->disconnectFromHost();
+			return;
+		}
+		header = "HTTP/1.1 " + QByteArray::number(route.status) + (route.status == 200 ? " OK" : " Error") + "\r\n";
+		header += "Content-Type: " + route.contentType + "\r\n";
+		header += "Content-Length: " + QByteArray::number(route.body.size()) + "\r\n";
+		header += "Cache-Control: " + route.cacheControl + "\r\n";
+		if (!route.etag.isEmpty())
+			header += "ETag: " + route.etag + "\r\n";
+		header += "Connection: close\r\n\r\n";
+		socket->write(header);
+
+		const QByteArray body = route.truncate ? route.body.left(route.body.size() / 2) : route.body;
+		const int pieceSize = (body.size() + route.pieces - 1) / route.pieces;
+		QPointer<QTcpSocket> target(socket);
+		for (int piece = 0; piece < route.pieces; piece++)
+		{
+			const QByteArray bytes = body.mid(piece * pieceSize, pieceSize);
+			const bool last = piece == route.pieces - 1;
+			QTimer::singleShot(piece * route.pieceDelayMs, socket, [target, bytes, last]() {
+				if (!target)
+					return;
+				target->write(bytes);
+				if (last)
+					target->disconnectFromHost();
+			});
+		}
+	}
+};
+
+static QByteArray encoded(const QSize &size, const char *format, QRandomGenerator &random)
+{
+	// Noise over a gradient, so the JPEG is big enough to take a while to arrive in pieces.
+	QImage image(size, QImage::Format_RGB32);
+	for (int y = 0; y < size.height(); y++)
+	{
+		QRgb *line = reinterpret_cast<QRgb*>(image.scanLine(y));
+		for (int x = 0; x < size.width(); x++)
+			line[x] = qRgb(x * 255 / size.width(), y * 255 / size.height(), int(random.bounded(256)));
+	}
+	QByteArray bytes;
+	QBuffer buffer(&bytes);
+	buffer.open(QIODevice::WriteOnly);
+	image.save(&buffer, format, 90);
+	return bytes;
+}
+
+template <typename Condition>
+static bool wait(Condition condition, const qint64 timeoutMs = 20000)
+{
+	QElapsedTimer timer;
+	timer.start();
+	while (!condition() && timer.elapsed() < timeoutMs)
+		QCoreApplication::processEvents(QEventLoop::AllEvents | QEventLoop::WaitForMoreEvents, 5);
+	return condition();
+}
+
+int main(int argc, char *argv[])
+{
+	QCoreApplication a(argc, argv);
+
+	QCommandLineParser parser;
+	parser.addOption(QCommandLineOption("output", "File to write the JSON report to, instead of stdout.", "FILE"));
+	parser.addHelpOption();
+	parser.process(a);
+
+	QRandomGenerator random(12345);
+	HttpStandIn server;
+	QTemporaryDir cacheDir;
+
+	// The slow image arrives in ten pieces over about two seconds, comfortably longer than the loader's interval between previews.
+	HttpStandIn::Route slow;
+	slow.body = encoded(QSize(1600, 1200), "JPG", random);
+	slow.contentType = "image/jpeg";
+	slow.pieces = 10;
+	slow.pieceDelayMs = 200;
+	server.route("/slow.jpg", slow);
+
+	// max-age=0 makes the cached copy stale straight away, so every load after the first is revalidated.
+	HttpStandIn::Route revalidated;
+	revalidated.body = encoded(QSize(64, 48), "PNG", random);
+	revalidated.contentType = "image/png";
+	revalidated.etag = "\"v1\"";
+	revalidated.cacheControl = "max-age=0";
+	server.route("/etag.png", revalidated);
+
+	HttpStandIn::Route truncated;
+	truncated.body = encoded(QSize(256, 256), "JPG", random);
+	truncated.contentType = "image/jpeg";
+	truncated.truncate = true;
+	server.route("/truncated.jpg", truncated);
+
+	NetworkLoader loader(cacheDir.path());
+	struct Result
+	{
+		bool loaded = false;
+		bool ok = false;
+		QByteArray data;
+		QString contentKey;
+		int previews = 0;
+	};
+	std::map<quint64, Result> resultList;
+	QObject::connect(&loader, &NetworkLoader::loaded, [&](quint64 id, QByteArray data, QString contentKey, bool ok) {
+		resultList[id].loaded = true;
+		resultList[id].ok = ok;
+		resultList[id].data = data;
+		resultList[id].contentKey = contentKey;
+	});
+	QObject::connect(&loader, &NetworkLoader::partialDecoded, [&](quint64 id, QImage image, QSize imageSize) {
+		if (!image.isNull() && imageSize == QSize(1600, 1200))
+			resultList[id].previews++;
+	});
+	auto loaded = [&](const quint64 id) { return resultList[id].loaded; };
+
+	QJsonObject checks;
+	checks["server_listening"] = server.isListening() && cacheDir.isValid();
+
+	// Progressive previews, and a second slide joining the first one's download.
+	loader.load(1, server.url("/slow.jpg"));
+	loader.load(2, server.url("/slow.jpg"));
+	wait([&]() { return loaded(1) && loaded(2); });
+	checks["slow_loaded"] = resultList[1].ok && resultList[1].data == slow.body;
+	checks["slow_previews"] = resultList[1].previews > 0;
+	checks["slow_shared"] = server.requests("/slow.jpg") == 1 && resultList[2].ok && resultList[2].data == slow.body && resultList[2].previews > 0;
+	checks["slow_content_key"] = resultList[1].contentKey == Slide::contentKeyOf(slow.body) && resultList[2].contentKey == resultList[1].contentKey;
+	checks["slow_not_loading"] = !loader.isLoading(1) && !loader.isLoading(2);
+
+	// Revalidation: the second load sends the ETag back, is told nothing has changed, and gets the cached body.
+	loader.load(3, server.url("/etag.png"));
+	wait([&]() { return loaded(3); });
+	loader.load(4, server.url("/etag.png"));
+	wait([&]() { return loaded(4); });
+	checks["etag_loaded"] = resultList[3].ok && resultList[3].data == revalidated.body;
+	checks["etag_revalidated"] = server.requests("/etag.png") == 2 && server.notModified("/etag.png") == 1;
+	checks["etag_from_cache"] = resultList[4].ok && resultList[4].data == revalidated.body;
+
+	// Failures: a missing image, and a body cut off part way through.
+	loader.load(5, server.url("/missing.png"));
+	loader.load(6, server.url("/truncated.jpg"));
+	wait([&]() { return loaded(5) && loaded(6); });
+	checks["missing_failed"] = loaded(5) && !resultList[5].ok && resultList[5].data.isEmpty();
+	checks["truncated_failed"] = loaded(6) && !resultList[6].ok && resultList[6].data.isEmpty();
+	checks["failed_no_content_key"] = resultList[5].contentKey.isEmpty() && resultList[6].contentKey.isEmpty();
+	checks["failed_not_loading"] = !loader.isLoading(5) && !loader.isLoading(6);
+
+	int failures = 0;
+	for (auto check = checks.constBegin(); check != checks.constEnd(); ++check)
+		if (!check.value().toBool())
+			failures++;
+	QJsonObject report;
+	report["checks"] = checks;
+	report["failures"] = failures;
+
+	const QByteArray json = QJsonDocument(report).toJson(QJsonDocument::Indented);
+	if (parser.isSet("output"))
+	{
+		QFile file(parser.value("output"));
+		if (!file.open(QIODevice::WriteOnly))
+			return 1;
+		file.write(json);
+	}
+	else
+		fwrite(json.constData(), 1, size_t(json.size()), stdout);
+	return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,99 @@
+/*
+This file is part of Photo Viewport.
+	Photo Viewport is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	Photo Viewport is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with Photo Viewport.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Checks that PixmapCache keeps to its byte budget. Keys of the tile cache (see TiledImageItem::tileKey) for the top row
+// of full resolution tiles look like slide 0's keys, and must be evicted like any other when nothing is pinned;
+// a pinned slide's pixmaps must survive eviction, and everything else still has to fit. Reports as JSON, and exits
+// with a non-zero status if any check fails, so it can gate a build.
+//
+// Usage: pixmap_cache_test [--output FILE]
+
+#include <QGuiApplication>
+#include <QCommandLineParser>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QFile>
+#include <QPixmap>
+#include "../PixmapCache.h"
+#include "../TiledImageItem.h"
+
+static QPixmap tile()
+{
+	// A tile's worth of pixels, 512 x 512 at 4 bytes a pixel (1 MB).
+	QPixmap pixmap(512, 512);
+	pixmap.fill(Qt::gray);
+	return pixmap;
+}
+
+int main(int argc, char *argv[])
+{
+	if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+		qputenv("QT_QPA_PLATFORM", "offscreen");
+	QGuiApplication a(argc, argv);
+
+	QCommandLineParser parser;
+	parser.addOption(QCommandLineOption("output", "File to write the JSON report to, instead of stdout.", "FILE"));
+	parser.addHelpOption();
+	parser.process(a);
+
+	const qint64 budget = qint64(8) * 1024 * 1024;
+	const QPixmap pixmap = tile();
+	const qint64 tileBytes = qint64(pixmap.width()) * pixmap.height() * pixmap.depth() / 8;
+	QJsonObject checks;
+
+	// The top row of a wide image's full resolution tiles, many times over the budget, with nothing pinned.
+	PixmapCache tileCache(budget);
+	for (int tileX = 0; tileX < 64; tileX++)
+		tileCache.insert(TiledImageItem::tileKey(0, tileX, 0), pixmap);
+	checks["tile_row_within_budget"] = tileCache.stats().bytesUsed <= budget;
+	checks["tile_row_evicted"] = tileCache.stats().evictions == quint64(64 - budget / tileBytes);
+	checks["tile_row_newest_kept"] = tileCache.contains(TiledImageItem::tileKey(0, 63, 0)) && !tileCache.contains(TiledImageItem::tileKey(0, 0, 0));
+
+	// Slide 0 isn't special either, until it's pinned.
+	PixmapCache slideCache(budget);
+	slideCache.insert(PixmapCache::keyOf(0, 0), pixmap);
+	for (quint64 slideId = 1; slideId <= 16; slideId++)
+		slideCache.insert(PixmapCache::keyOf(slideId, 0), pixmap);
+	checks["slide_zero_evicted"] = !slideCache.contains(PixmapCache::keyOf(0, 0)) && slideCache.stats().bytesUsed <= budget;
+
+	// A pinned slide's levels stay put, however much comes in after them, and the rest still keeps to what's left.
+	PixmapCache pinnedCache(budget);
+	pinnedCache.pinSlide(7);
+	pinnedCache.insert(PixmapCache::keyOf(7, 0), pixmap);
+	pinnedCache.insert(PixmapCache::keyOf(7, 1), pixmap);
+	for (quint64 slideId = 100; slideId < 132; slideId++)
+		pinnedCache.insert(PixmapCache::keyOf(slideId, 0), pixmap);
+	checks["pinned_kept"] = pinnedCache.contains(PixmapCache::keyOf(7, 0)) && pinnedCache.contains(PixmapCache::keyOf(7, 1));
+	checks["pinned_within_budget"] = pinnedCache.stats().bytesUsed <= budget;
+
+	int failures = 0;
+	for (auto check = checks.constBegin(); check != checks.constEnd(); ++check)
+		if (!check.value().toBool())
+			failures++;
+	QJsonObject report;
+	report["checks"] = checks;
+	report["failures"] = failures;
+
+	const QByteArray json = QJsonDocument(report).toJson(QJsonDocument::Indented);
+	if (parser.isSet("output"))
+	{
+		QFile file(parser.value("output"));
+		if (!file.open(QIODevice::WriteOnly))
+			return 1;
+		file.write(json);
+	}
+	else
+		fwrite(json.constData(), 1, size_t(json.size()), stdout);
+	return failures > 0 ? 1 : 0;
+}
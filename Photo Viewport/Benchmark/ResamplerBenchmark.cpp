@@ -0,0 +1,283 @@
+/*
+This file is part of Photo Viewport.
+	Photo Viewport is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	Photo Viewport is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with Photo Viewport.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Checks the resampler against a straightforward floating point implementation of the same filters,
+// checks that every SIMD kernel gives exactly the same pixels as the scalar one, and then times each kernel
+// (and Qt's own smooth scaling, for comparison) on a few typical reductions. Reports as JSON, and exits
+// with a non-zero status if any check fails, so it can gate a build.
+//
+// Usage: resampler_benchmark [--iterations N] [--output FILE]
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <map>
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QFile>
+#include <QRandomGenerator>
+#include <QThread>
+#include "../Resampler.h"
+
+struct ReferenceWeight
+{
+	int index;
+	double weight;
+};
+
+static double referenceFilter(const Resampler::Filter filter, const double x)
+{
+	const double pi = 3.14159265358979323846;
+	const double distance = std::fabs(x);
+	if (filter == Resampler::Filter::Bicubic)
+	{
+		if (distance < 1.0)
+			return 1.5 * distance * distance * distance - 2.5 * distance * distance + 1.0;
+		if (distance < 2.0)
+			return -0.5 * distance * distance * distance + 2.5 * distance * distance - 4.0 * distance + 2.0;
+		return 0.0;
+	}
+	if (distance < 1e-8)
+		return 1.0;
+	if (distance >= 3.0)
+		return 0.0;
+	return std::sin(pi * distance) / (pi * distance) * std::sin(pi * distance / 3.0) / (pi * distance / 3.0);
+}
+
+static std::vector<std::vector<ReferenceWeight>> referenceWeights(const int sizeSource, const int sizeTarget, const Resampler::Filter filter)
+{
+	// Written out from the definitions, independently of the resampler: area averaging is each source pixel's overlap
+	// with the target pixel's footprint, and the other filters are stretched to cover the footprint when reducing.
+	const double ratio = double(sizeSource) / sizeTarget;
+	const double stretch = std::max(1.0, ratio);
+	std::vector<std::vector<ReferenceWeight>> weightList(sizeTarget);
+	for (int index = 0; index < sizeTarget; index++)
+	{
+		double sum = 0.0;
+		for (int position = 0; position < sizeSource; position++)
+		{
+			double weight;
+			if (filter == Resampler::Filter::Area)
+				weight = std::max(0.0, std::min(position + 1.0, (index + 0.5) * ratio + stretch / 2) - std::max(double(position), (index + 0.5) * ratio - stretch / 2));
+			else
+				weight = referenceFilter(filter, (position + 0.5 - (index + 0.5) * ratio) / stretch);
+			if (weight != 0.0)
+			{
+				weightList[index].push_back({ position, weight });
+				sum += weight;
+			}
+		}
+		for (ReferenceWeight &weight : weightList[index])
+			weight.weight /= sum;
+	}
+	return weightList;
+}
+
+static QImage referenceScaled(const QImage &image, const QSize &size, const Resampler::Filter filter)
+{
+	const QImage source = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+	const auto horizontal = referenceWeights(source.width(), size.width(), filter);
+	const auto vertical = referenceWeights(source.height(), size.height(), filter);
+	std::vector<double> between(size_t(size.width()) * source.height() * 4, 0.0);
+	for (int y = 0; y < source.height(); y++)
+	{
+		const QRgb *line = reinterpret_cast<const QRgb*>(source.constScanLine(y));
+		for (int x = 0; x < size.width(); x++)
+		{
+			double *channel = &between[(size_t(y) * size.width() + x) * 4];
+			for (const ReferenceWeight &weight : horizontal[x])
+			{
+				channel[0] += qBlue(line[weight.index]) * weight.weight;
+				channel[1] += qGreen(line[weight.index]) * weight.weight;
+				channel[2] += qRed(line[weight.index]) * weight.weight;
+				channel[3] += qAlpha(line[weight.index]) * weight.weight;
+			}
+			// The rows in between are an image in their own right, so ringing past what's valid premultiplied data is clamped here too.
+			channel[3] = qBound(0.0, channel[3], 255.0);
+			for (int c = 0; c < 3; c++)
+				channel[c] = qBound(0.0, channel[c], channel[3]);
+		}
+	}
+	QImage target(size, QImage::Format_ARGB32_Premultiplied);
+	for (int y = 0; y < size.height(); y++)
+	{
+		QRgb *line = reinterpret_cast<QRgb*>(target.scanLine(y));
+		for (int x = 0; x < size.width(); x++)
+		{
+			double channel[4] = { 0.0, 0.0, 0.0, 0.0 };
+			for (const ReferenceWeight &weight : vertical[y])
+				for (int c = 0; c < 4; c++)
+					channel[c] += between[(size_t(weight.index) * size.width() + x) * 4 + c] * weight.weight;
+			const int alpha = qBound(0, int(std::lround(channel[3])), 255);
+			auto colour = [&](const double value) { return qBound(0, int(std::lround(value)), alpha); };
+			line[x] = qRgba(colour(channel[2]), colour(channel[1]), colour(channel[0]), alpha);
+		}
+	}
+	return target;
+}
+
+static int differenceMax(const QImage &first, const QImage &second)
+{
+	if (first.size() != second.size())
+		return 256;
+	int difference = 0;
+	for (int y = 0; y < first.height(); y++)
+	{
+		const uchar *lineFirst = first.constScanLine(y);
+		const uchar *lineSecond = second.constScanLine(y);
+		for (int x = 0; x < first.width() * 4; x++)
+			difference = std::max(difference, std::abs(int(lineFirst[x]) - int(lineSecond[x])));
+	}
+	return difference;
+}
+
+static QImage sampleImage(const QSize &size, const bool alpha, QRandomGenerator &random)
+{
+	// Smooth gradients (where rounding errors would show as banding) with noise and hard edges over them (where ringing shows).
+	QImage image(size, alpha ? QImage::Format_ARGB32_Premultiplied : QImage::Format_RGB32);
+	for (int y = 0; y < size.height(); y++)
+	{
+		QRgb *line = reinterpret_cast<QRgb*>(image.scanLine(y));
+		for (int x = 0; x < size.width(); x++)
+		{
+			const int a = alpha ? ((x / 7 + y / 5) % 3 == 0 ? 0 : int(random.bounded(256))) : 255;
+			const int edge = (x / 16 + y / 16) % 2 == 0 ? 255 : 0;
+			const int red = (x * 255) / std::max(1, size.width() - 1);
+			const int green = (y * 255) / std::max(1, size.height() - 1);
+			const int blue = (edge + int(random.bounded(64))) % 256;
+			line[x] = qRgba(red * a / 255, green * a / 255, blue * a / 255, a);
+		}
+	}
+	return image;
+}
+
+static const char* kernelName(const Resampler::Kernel kernel)
+{
+	switch (kernel)
+	{
+	case Resampler::Kernel::Scalar:
+		return "scalar";
+	case Resampler::Kernel::Sse2:
+		return "sse2";
+	case Resampler::Kernel::Avx2:
+		return "avx2";
+	default:
+		return "auto";
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	QCoreApplication a(argc, argv);
+
+	QCommandLineParser parser;
+	parser.addOption(QCommandLineOption("iterations", "Timed runs of each kernel on each case.", "N", "5"));
+	parser.addOption(QCommandLineOption("output", "File to write the JSON report to, instead of stdout.", "FILE"));
+	parser.addHelpOption();
+	parser.process(a);
+	const int iterations = qMax(1, parser.value("iterations").toInt());
+
+	std::vector<Resampler::Kernel> kernelList;
+	for (const Resampler::Kernel kernel : { Resampler::Kernel::Scalar, Resampler::Kernel::Sse2, Resampler::Kernel::Avx2 })
+		if (int(kernel) <= int(Resampler::kernelBest()))
+			kernelList.push_back(kernel);
+
+	// Correctness: small odd sizes, so edges, tails shorter than a SIMD register and every filter get covered
+	// without the reference taking forever. Rounding in the fixed point weights and the 8-bit intermediate rows
+	// is allowed to put a channel out by up to 2 from the reference; kernels must agree with each other exactly.
+	QRandomGenerator random(12345);
+	const int referenceTolerance = 2;
+	int cases = 0;
+	int failures = 0;
+	int referenceDifferenceMax = 0;
+	for (const bool alpha : { false, true })
+	{
+		for (const QSize &sizeSource : { QSize(97, 61), QSize(256, 255), QSize(33, 300) })
+		{
+			const QImage image = sampleImage(sizeSource, alpha, random);
+			for (const QSize &size : { QSize(1, 1), QSize(13, 7), QSize(48, 31), QSize(61, 97), QSize(200, 301) })
+			{
+				for (const Resampler::Filter filter : { Resampler::Filter::Area, Resampler::Filter::Bicubic, Resampler::Filter::Lanczos3 })
+				{
+					cases++;
+					const QImage expected = referenceScaled(image, size, filter);
+					const QImage scalar = Resampler::scaled(image, size, filter, Resampler::Kernel::Scalar)
+						.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+					const int difference = differenceMax(scalar, expected);
+					referenceDifferenceMax = std::max(referenceDifferenceMax, difference);
+					bool failed = difference > referenceTolerance;
+					for (const Resampler::Kernel kernel : kernelList)
+						if (differenceMax(Resampler::scaled(image, size, filter, kernel).convertToFormat(QImage::Format_ARGB32_Premultiplied), scalar) != 0)
+							failed = true;
+					if (failed)
+						failures++;
+				}
+			}
+		}
+	}
+
+	// Performance: a 24 megapixel photo reduced to the sizes the viewer asks for most
+	// (pyramid levels, a screen sized view, a slight reduction and a thumbnail). Each is the median of the runs.
+	const QImage photo = sampleImage(QSize(6000, 4000), false, random);
+	QJsonObject timings;
+	for (const QSize &size : { QSize(3000, 2000), QSize(750, 500), QSize(1920, 1280), QSize(4500, 3000), QSize(256, 171) })
+	{
+		std::map<QString, std::vector<double>> sampleMap;
+		for (int iteration = 0; iteration < iterations; iteration++)
+		{
+			QElapsedTimer timer;
+			timer.start();
+			photo.scaled(size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+			sampleMap["qt_smooth"].push_back(timer.nsecsElapsed() / 1e6);
+			for (const Resampler::Kernel kernel : kernelList)
+			{
+				timer.restart();
+				Resampler::scaled(photo, size, Resampler::Filter::Auto, kernel);
+				sampleMap[kernelName(kernel)].push_back(timer.nsecsElapsed() / 1e6);
+			}
+		}
+		QJsonObject timing;
+		for (auto &samples : sampleMap)
+		{
+			std::sort(samples.second.begin(), samples.second.end());
+			timing[samples.first] = samples.second[samples.second.size() / 2];
+		}
+		timings[QString("%1x%2->%3x%4").arg(photo.width()).arg(photo.height()).arg(size.width()).arg(size.height())] = timing;
+	}
+
+	QJsonObject correctness;
+	correctness["cases"] = cases;
+	correctness["failures"] = failures;
+	correctness["reference_difference_max"] = referenceDifferenceMax;
+	QJsonObject report;
+	report["kernel_best"] = kernelName(Resampler::kernelBest());
+	report["threads"] = QThread::idealThreadCount();
+	report["correctness"] = correctness;
+	report["median_ms"] = timings;
+
+	const QByteArray json = QJsonDocument(report).toJson(QJsonDocument::Indented);
+	if (parser.isSet("output"))
+	{
+		QFile file(parser.value("output"));
+		if (!file.open(QIODevice::WriteOnly))
+			return 1;
+		file.write(json);
+	}
+	else
+		fwrite(json.constData(), 1, size_t(json.size()), stdout);
+	return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,413 @@
+/*
+This file is part of Photo Viewport.
+	Photo Viewport is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	Photo Viewport is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with Photo Viewport.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Runs the viewport headless (on Qt's offscreen platform) against a corpus of generated images,
+// and reports how long the hot paths take as JSON, so they can be compared from one build to the next.
+// Each operation is timed from the call until the slide it leaves on screen has actually been decoded and put up,
+// since most of the work now happens in the background, and the call itself returning says little on its own.
+//
+// Usage: viewport_benchmark [--count N] [--iterations N] [--corpus DIR] [--output FILE]
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <map>
+#include <QApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QRandomGenerator>
+#include <QPainter>
+#include <QLinearGradient>
+#include "../Viewport.h"
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#endif
+
+class ViewportBenchmark
+{
+public:
+	ViewportBenchmark(Viewport &viewport)
+		: viewport(viewport)
+	{
+	}
+
+	double imgApply(const QString &path)
+	{
+		return timed([&]() { viewport.imgApply(Slide::fromFile(path)); });
+	}
+
+	double slideLeft()
+	{
+		return timed([&]() { viewport.slideLeft(); });
+	}
+
+	double slideRight()
+	{
+		return timed([&]() { viewport.slideRight(); });
+	}
+
+	double zoomIn()
+	{
+		return timed([&]() { viewport.zoomIn(); });
+	}
+
+	double zoomOut()
+	{
+		return timed([&]() { viewport.zoomOut(); });
+	}
+
+	double paint()
+	{
+		// A full repaint of the view as it stands, done synchronously, for the cost of drawing the slide on its own.
+		QElapsedTimer timer;
+		timer.start();
+		viewport.viewport()->repaint();
+		return timer.nsecsElapsed() / 1e6;
+	}
+
+	double zoomSettle()
+	{
+		// After a burst of zoom steps, how long until the level it ended on has been decoded and refined at full quality.
+		QElapsedTimer timer;
+		timer.start();
+		wait([&]() { return !viewport.zoomSettleTimer.isActive() && !viewport.zoomRefiner.isPending() && settled(); });
+		return timer.nsecsElapsed() / 1e6;
+	}
+
+	double adjustToLastZoomLevel(const int zoomLevel)
+	{
+		return timed([&]() { viewport.adjustToLastZoomLevel(zoomLevel); });
+	}
+
+	double imgSaveCurrent(const QString &path, const QByteArray &format)
+	{
+		// Saving is done once the encoder reports the file written, rather than when the slide is on screen.
+		bool saved = false;
+		quint64 batchId = 0;
+		QMetaObject::Connection connection = QObject::connect(&viewport.imageEncoder, &ImageEncoder::finished, [&](quint64 batchIdFinished) {
+			if (batchIdFinished == batchId)
+				saved = true;
+		});
+		QElapsedTimer timer;
+		timer.start();
+		batchId = viewport.imgSave(path, format, -1);
+		wait([&]() { return saved; });
+		const double ms = timer.nsecsElapsed() / 1e6;
+		QObject::disconnect(connection);
+		return ms;
+	}
+
+	double sessionSave(const QString &path, const int slideCount)
+	{
+		// The slideshow repeated out to the given number of slides, for how saving (and restoring) copes with a long one.
+		std::vector<Slide> slideList;
+		for (int index = 0; index < slideCount; index++)
+			slideList.push_back(viewport.slideList[index % viewport.slideList.size()]);
+		QElapsedTimer timer;
+		timer.start();
+		SessionFile::save(path, slideList, viewport.sessionView());
+		return timer.nsecsElapsed() / 1e6;
+	}
+
+	double sessionRestore(const QString &path)
+	{
+		return timed([&]() { viewport.sessionRestore(path); });
+	}
+
+	SlideshowPlayer::Stats slideshow(const int intervalMs)
+	{
+		// Plays from the first slide through to the last at the given interval, for how well playback keeps to its deadlines.
+		viewport.slideGoTo(0);
+		wait([&]() { return settled(); });
+		viewport.slideshowPlayer.setInterval(intervalMs);
+		viewport.actionToggleSlideshow.get()->setChecked(true);
+		wait([&]() { return !viewport.slideshowPlayer.isPlaying(); });
+		viewport.actionToggleSlideshow.get()->setChecked(false);
+		return viewport.slideshowPlayer.stats();
+	}
+
+private:
+	Viewport &viewport;
+	const qint64 settleTimeoutMs = 60000;
+
+	template <typename Operation>
+	double timed(Operation operation)
+	{
+		QElapsedTimer timer;
+		timer.start();
+		operation();
+		wait([&]() { return settled(); });
+		return timer.nsecsElapsed() / 1e6;
+	}
+
+	template <typename Condition>
+	void wait(Condition condition)
+	{
+		QElapsedTimer timer;
+		timer.start();
+		while (!condition() && timer.elapsed() < settleTimeoutMs)
+			QCoreApplication::processEvents(QEventLoop::AllEvents | QEventLoop::WaitForMoreEvents, 5);
+	}
+
+	bool settled() const
+	{
+		// The slide on screen is settled once nothing more is on its way for it and there's something showing.
+		if (viewport.slideList.empty())
+			return true;
+		const quint64 id = viewport.slideList[viewport.slideListIndexCurrent].contentId;
+		if (viewport.decodePool.isPendingSlide(id))
+			return false;
+		return viewport.tiledItem || !viewport.pixmapItem.get()->pixmap().isNull();
+	}
+};
+
+struct CorpusEntry
+{
+	QSize size;
+	QByteArray format;
+	QImage::Format pixelFormat;
+};
+
+static QImage corpusImage(const QSize &size, QRandomGenerator &random)
+{
+	// A gradient with noise over it, so the images compress about as well as photos do (not as well as flat colour would).
+	QImage image(size, QImage::Format_RGB32);
+	QPainter painter(&image);
+	QLinearGradient gradient(0, 0, size.width(), size.height());
+	gradient.setColorAt(0, QColor::fromHsv(random.bounded(360), 200, 220));
+	gradient.setColorAt(1, QColor::fromHsv(random.bounded(360), 200, 120));
+	painter.fillRect(image.rect(), gradient);
+	painter.end();
+	for (int y = 0; y < image.height(); y++)
+	{
+		QRgb *line = reinterpret_cast<QRgb*>(image.scanLine(y));
+		for (int x = 0; x < image.width(); x++)
+		{
+			const int noise = int(random.bounded(32)) - 16;
+			line[x] = qRgb(
+				qBound(0, qRed(line[x]) + noise, 255),
+				qBound(0, qGreen(line[x]) + noise, 255),
+				qBound(0, qBlue(line[x]) + noise, 255)
+			);
+		}
+	}
+	return image;
+}
+
+static QStringList corpusBuild(const QString &dir, const int countPerKind)
+{
+	const std::vector<CorpusEntry> kindList = {
+		{ QSize(640, 480), "jpg", QImage::Format_RGB32 },
+		{ QSize(1920, 1080), "jpg", QImage::Format_RGB32 },
+		{ QSize(1920, 1080), "png", QImage::Format_RGB32 },
+		{ QSize(4000, 3000), "jpg", QImage::Format_RGB32 },
+		{ QSize(4000, 3000), "png", QImage::Format_RGB32 },
+		{ QSize(1024, 768), "bmp", QImage::Format_RGB32 },
+		// These decode to formats the paint engine has to convert: RGBA (opaque, as most are), and 8-bit palette.
+		{ QSize(2560, 1440), "png", QImage::Format_ARGB32 },
+		{ QSize(800, 600), "png", QImage::Format_Indexed8 },
+	};
+	QRandomGenerator random(12345);
+	QStringList pathList;
+	for (int index = 0; index < countPerKind; index++)
+	{
+		for (const CorpusEntry &kind : kindList)
+		{
+			const QString path = QString("%1/%2x%3-%4.%5").arg(dir).arg(kind.size.width()).arg(kind.size.height()).arg(index).arg(QString(kind.format));
+			if (!QFile::exists(path))
+				corpusImage(kind.size, random).convertToFormat(kind.pixelFormat).save(path, kind.format.constData(), 90);
+			pathList.append(path);
+		}
+	}
+	return pathList;
+}
+
+static QJsonObject latencyOf(std::vector<double> sampleList)
+{
+	QJsonObject latency;
+	if (sampleList.empty())
+		return latency;
+	std::sort(sampleList.begin(), sampleList.end());
+	auto percentile = [&](const double p) {
+		const int index = qBound(0, int(std::ceil(p * sampleList.size())) - 1, int(sampleList.size()) - 1);
+		return sampleList[index];
+	};
+	latency["samples"] = int(sampleList.size());
+	latency["p50_ms"] = percentile(0.50);
+	latency["p99_ms"] = percentile(0.99);
+	latency["max_ms"] = sampleList.back();
+	return latency;
+}
+
+static qint64 peakRssBytes()
+{
+#ifdef Q_OS_UNIX
+	// Linux reports ru_maxrss in kilobytes.
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) == 0)
+		return qint64(usage.ru_maxrss) * 1024;
+#endif
+	return -1;
+}
+
+int main(int argc, char *argv[])
+{
+	if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+		qputenv("QT_QPA_PLATFORM", "offscreen");
+	QApplication a(argc, argv);
+	a.setOrganizationName("Photo Viewport Benchmark");
+	a.setApplicationName("Photo Viewport Benchmark");
+
+	QCommandLineParser parser;
+	parser.addOption(QCommandLineOption("count", "Images of each size and format in the corpus.", "N", "4"));
+	parser.addOption(QCommandLineOption("iterations", "Passes over the slideshow for navigation and zoom.", "N", "3"));
+	parser.addOption(QCommandLineOption("corpus", "Directory to generate (or reuse) the corpus in.", "DIR"));
+	parser.addOption(QCommandLineOption("output", "File to write the JSON report to, instead of stdout.", "FILE"));
+	parser.addHelpOption();
+	parser.process(a);
+
+	QTemporaryDir corpusTemp;
+	const QString corpusDir = parser.isSet("corpus") ? parser.value("corpus") : corpusTemp.path();
+	QDir().mkpath(corpusDir);
+	QTemporaryDir saveDir;
+	const QStringList pathList = corpusBuild(corpusDir, qMax(1, parser.value("count").toInt()));
+	const int iterations = qMax(1, parser.value("iterations").toInt());
+
+	Viewport viewport;
+	viewport.resize(1280, 720);
+	viewport.show();
+	ViewportBenchmark benchmark(viewport);
+	std::map<QString, std::vector<double>> sampleMap;
+
+	// Loading: every image is opened and brought on screen in turn.
+	QElapsedTimer loadTimer;
+	loadTimer.start();
+	for (const QString &path : pathList)
+		sampleMap["imgApply"].push_back(benchmark.imgApply(path));
+	const double loadSeconds = loadTimer.nsecsElapsed() / 1e9;
+
+	// Navigation: back and forth through the whole slideshow, at the native zoom level.
+	benchmark.adjustToLastZoomLevel(0);
+	for (int pass = 0; pass < iterations; pass++)
+	{
+		for (int step = 1; step < pathList.size(); step++)
+			sampleMap["slideLeft"].push_back(benchmark.slideLeft());
+		for (int step = 1; step < pathList.size(); step++)
+			sampleMap["slideRight"].push_back(benchmark.slideRight());
+	}
+
+	// Painting: each slide redrawn a few times over once it's settled, at the native zoom level and zoomed out.
+	for (int step = 0; step < pathList.size(); step++)
+	{
+		for (const int zoomLevel : { 0, -4 })
+		{
+			benchmark.adjustToLastZoomLevel(zoomLevel);
+			benchmark.zoomSettle();
+			for (int pass = 0; pass < iterations; pass++)
+				sampleMap[zoomLevel == 0 ? "paint" : "paintZoomedOut"].push_back(benchmark.paint());
+		}
+		benchmark.slideLeft();
+	}
+	benchmark.adjustToLastZoomLevel(0);
+
+	// Zoom: stepping out and back in on each slide (each burst timed until it has settled at full quality), then jumping straight to a zoom level (as sliding onto a slide does).
+	for (int pass = 0; pass < iterations; pass++)
+	{
+		for (int step = 1; step < pathList.size(); step++)
+		{
+			for (int zoom = 0; zoom < 6; zoom++)
+				sampleMap["zoomOut"].push_back(benchmark.zoomOut());
+			sampleMap["zoomSettle"].push_back(benchmark.zoomSettle());
+			for (int zoom = 0; zoom < 8; zoom++)
+				sampleMap["zoomIn"].push_back(benchmark.zoomIn());
+			sampleMap["zoomSettle"].push_back(benchmark.zoomSettle());
+			sampleMap["adjustToLastZoomLevel"].push_back(benchmark.adjustToLastZoomLevel(pass % 2 == 0 ? -4 : 0));
+			benchmark.slideLeft();
+		}
+		for (int step = 1; step < pathList.size(); step++)
+			benchmark.slideRight();
+	}
+	benchmark.adjustToLastZoomLevel(0);
+
+	// Saving: the current slide in each of the formats we can save to.
+	for (int pass = 0; pass < iterations; pass++)
+	{
+		for (const QByteArray format : { QByteArray("png"), QByteArray("jpg"), QByteArray("bmp") })
+		{
+			sampleMap["imgSaveCurrent"].push_back(benchmark.imgSaveCurrent(saveDir.filePath("save." + QString(format)), format));
+			sampleMap["imgSaveCurrent_" + QString(format)].push_back(sampleMap["imgSaveCurrent"].back());
+		}
+		benchmark.slideLeft();
+	}
+
+	// Session: the slideshow saved at 5000 slides, then restored into a fresh viewport, timed until the slide it was on is up again.
+	const QString sessionPath = saveDir.filePath("session.pvs");
+	for (int pass = 0; pass < iterations; pass++)
+	{
+		sampleMap["sessionSave"].push_back(benchmark.sessionSave(sessionPath, 5000));
+		Viewport viewportRestored;
+		viewportRestored.resize(1280, 720);
+		viewportRestored.show();
+		sampleMap["sessionRestore"].push_back(ViewportBenchmark(viewportRestored).sessionRestore(sessionPath));
+	}
+
+	// Slideshow: played through once at a quarter of a second per slide, which the largest images take about as long as to decode.
+	const SlideshowPlayer::Stats slideshowStats = benchmark.slideshow(250);
+	QJsonObject slideshow;
+	slideshow["interval_ms"] = 250;
+	slideshow["advances"] = slideshowStats.advances;
+	slideshow["deadlines_missed"] = slideshowStats.deadlinesMissed;
+	slideshow["advances_unready"] = slideshowStats.advancesUnready;
+	slideshow["late_ms_max"] = slideshowStats.lateMsMax;
+	slideshow["jitter_ms_mean"] = slideshowStats.jitterMsMean;
+	slideshow["lookahead"] = slideshowStats.lookahead;
+
+	// Decode cost per format, over everything decoded during the run.
+	QJsonObject decodeByFormat;
+	for (auto& format : DecoderRegistry::stats())
+	{
+		QJsonObject cost;
+		cost["decodes"] = format.decodes;
+		cost["mean_ms"] = format.msTotal / format.decodes;
+		cost["max_ms"] = format.msMax;
+		decodeByFormat[QString(format.format)] = cost;
+	}
+
+	QJsonObject latency;
+	for (auto& samples : sampleMap)
+		latency[samples.first] = latencyOf(samples.second);
+	QJsonObject report;
+	report["corpus_images"] = pathList.size();
+	report["latency"] = latency;
+	report["slideshow"] = slideshow;
+	report["decode_by_format"] = decodeByFormat;
+	report["throughput_images_per_second"] = loadSeconds > 0 ? pathList.size() / loadSeconds : 0.0;
+	report["peak_rss_bytes"] = double(peakRssBytes());
+
+	const QByteArray json = QJsonDocument(report).toJson(QJsonDocument::Indented);
+	if (parser.isSet("output"))
+	{
+		QFile file(parser.value("output"));
+		if (!file.open(QIODevice::WriteOnly))
+			return 1;
+		file.write(json);
+	}
+	else
+		fwrite(json.constData(), 1, size_t(json.size()), stdout);
+	return 0;
+}
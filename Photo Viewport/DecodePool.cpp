@@ -0,0 +1,151 @@
+/*
+This file is part of Photo Viewport.
+	Photo Viewport is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	Photo Viewport is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with Photo Viewport.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "DecodePool.h"
+#include <QThread>
+#include <QElapsedTimer>
+
+class DecodePool::Task : public QRunnable
+{
+public:
+	Task(DecodePool *pool, const Slide &slide, const int level, const int priority)
+		: pool(pool), slide(slide), level(level), priority(priority)
+	{
+		// Tasks are deleted by the pool once their result has been handed back on the GUI thread,
+		// so that a pending task pointer is always safe to look up or take back out of the queue.
+		setAutoDelete(false);
+	}
+
+	void run() override
+	{
+		// Images big enough to be shown tiled are never decoded whole; we only report their size,
+		// and the tiled item decodes what it needs, a tile at a time.
+		// Otherwise, the level asked for may be past what the image can be scaled down to
+		// (the requester doesn't always know the size yet), so we report the level we actually decoded at.
+		// The image is handed back in the format it'll be painted in (see Slide::paintReady), so turning it into a pixmap
+		// on the GUI thread doesn't involve converting it there.
+		// The size and the pixels come from the same reader, so the image is only opened (and its header parsed) once.
+		Trace::Scope trace("decode");
+		QElapsedTimer timer;
+		timer.start();
+		QBuffer buffer;
+		QImageReader reader;
+		slide.readerSetup(reader, buffer);
+		const QSize imageSize = slide.imageSize(reader);
+		const bool animated = slide.supportsAnimation(reader);
+		const int levelDecoded = Slide::levelClamp(imageSize, level);
+		QImage image = TiledImageItem::wantsTiling(imageSize) ? QImage() : Slide::paintReady(slide.decode(reader, levelDecoded));
+		DecodePool *poolTarget = pool;
+		const quint64 key = PixmapCache::keyOf(slide.contentId, level);
+		const double ms = timer.nsecsElapsed() / 1e6;
+		QMetaObject::invokeMethod(pool, [poolTarget, key, levelDecoded, image, imageSize, animated, ms]() {
+			poolTarget->taskFinished(key, levelDecoded, image, imageSize, animated, ms);
+		}, Qt::QueuedConnection);
+	}
+
+	DecodePool *pool;
+	Slide slide;
+	int level;
+	int priority;
+};
+
+DecodePool::DecodePool(QObject *parent)
+	: QObject(parent)
+{
+	threadPool.setMaxThreadCount(QThread::idealThreadCount());
+}
+
+DecodePool::~DecodePool()
+{
+	threadPool.clear();
+	threadPool.waitForDone();
+	for (auto& pending : taskPending)
+		delete pending.second;
+}
+
+void DecodePool::request(const Slide &slide, const int level, const int priority)
+{
+	// A slide from the web has nothing to decode until its download has finished.
+	if (slide.source == Slide::Source::Url && slide.data.isEmpty())
+		return;
+
+	const quint64 key = PixmapCache::keyOf(slide.contentId, level);
+	auto found = taskPending.find(key);
+	if (found != taskPending.end())
+	{
+		// Already on its way. If it's now wanted more urgently (e.g. the user moved onto it),
+		// we pull it out of the queue and put it back in at the higher priority.
+		// If it has already started running, there's nothing to gain by doing anything.
+		Task *task = found->second;
+		if (priority > task->priority && threadPool.tryTake(task))
+		{
+			task->priority = priority;
+			threadPool.start(task, priority);
+		}
+		return;
+	}
+
+	Task *task = new Task(this, slide, level, priority);
+	taskPending[key] = task;
+	taskPendingPerSlide[slide.contentId]++;
+	threadPool.start(task, priority);
+}
+
+bool DecodePool::cancel(const quint64 key)
+{
+	// Only work that hasn't started yet can be taken back. A decode that's already running
+	// is left to finish, since its result may still be useful to the cache.
+	auto found = taskPending.find(key);
+	if (found == taskPending.end() || !threadPool.tryTake(found->second))
+		return false;
+
+	taskForget(found);
+	return true;
+}
+
+bool DecodePool::isPending(const quint64 key) const
+{
+	return taskPending.find(key) != taskPending.end();
+}
+
+bool DecodePool::isPendingSlide(const quint64 id) const
+{
+	return taskPendingPerSlide.find(id) != taskPendingPerSlide.end();
+}
+
+double DecodePool::decodeMsLast() const
+{
+	return decodeMs;
+}
+
+void DecodePool::taskForget(std::unordered_map<quint64, Task*>::iterator pending)
+{
+	auto perSlide = taskPendingPerSlide.find(pending->second->slide.contentId);
+	if (perSlide != taskPendingPerSlide.end() && --perSlide->second == 0)
+		taskPendingPerSlide.erase(perSlide);
+	delete pending->second;
+	taskPending.erase(pending);
+}
+
+void DecodePool::taskFinished(const quint64 key, const int level, const QImage &image, const QSize &imageSize, const bool animated, const double ms)
+{
+	decodeMs = ms;
+	auto found = taskPending.find(key);
+	if (found == taskPending.end())
+		return;
+
+	const quint64 id = found->second->slide.contentId;
+	taskForget(found);
+	emit decoded(id, level, image, imageSize, animated);
+}
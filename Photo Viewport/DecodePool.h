@@ -0,0 +1,56 @@
+/*
+This file is part of Photo Viewport.
+	Photo Viewport is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	Photo Viewport is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with Photo Viewport.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <unordered_map>
+#include <QObject>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QImage>
+#include "Slide.h"
+#include "PixmapCache.h"
+#include "TiledImageItem.h"
+#include "Trace.h"
+
+// Decoding is done off the GUI thread, on a pool of worker threads sized to the core count.
+// Workers produce QImages (which are safe to create outside the GUI thread) and hand them back
+// to the GUI thread through the decoded() signal, where they can be turned into QPixmaps.
+// Whether the image's format can be animated comes back with it, found out from the same reader, so the GUI thread never has to open the image to ask.
+// A slide can be decoded at any level of its zoom pyramid (see Slide::levelSize), and requests
+// are tracked by their pixmap cache key, so the same slide can have different levels on their way at once.
+class DecodePool : public QObject
+{
+	Q_OBJECT
+
+public:
+	DecodePool(QObject *parent = Q_NULLPTR);
+	~DecodePool();
+	void request(const Slide &slide, const int level, const int priority = 0);
+	bool cancel(const quint64 key);
+	bool isPending(const quint64 key) const;
+	bool isPendingSlide(const quint64 id) const;
+	double decodeMsLast() const;
+
+signals:
+	void decoded(quint64 id, int level, QImage image, QSize imageSize, bool animated);
+
+private:
+	class Task;
+	QThreadPool threadPool;
+	std::unordered_map<quint64, Task*> taskPending;
+	std::unordered_map<quint64, int> taskPendingPerSlide;
+	double decodeMs = 0;
+	void taskForget(std::unordered_map<quint64, Task*>::iterator pending);
+	void taskFinished(const quint64 key, const int level, const QImage &image, const QSize &imageSize, const bool animated, const double ms);
+};
@@ -0,0 +1,232 @@
+/*
+This file is part of Photo Viewport.
+	Photo Viewport is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	Photo Viewport is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with Photo Viewport.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "DecoderRegistry.h"
+#include <cstring>
+#include <map>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutex>
+#include <QReadWriteLock>
+#include <QElapsedTimer>
+#include "Slide.h"
+#include "Resampler.h"
+
+namespace
+{
+	bool headStartsWith(const QByteArray &head, const char *signature, const int length, const int offset = 0)
+	{
+		return head.size() >= offset + length && memcmp(head.constData() + offset, signature, size_t(length)) == 0;
+	}
+
+	// The formats we know about to begin with. Each is only offered if Qt turns out to have a plugin for it,
+	// which for WebP and TIFF means the Qt Image Formats module being deployed alongside the app.
+	struct Registry
+	{
+		QReadWriteLock decoderLock;
+		std::vector<DecoderRegistry::Decoder> decoderList;
+		QList<QByteArray> formatAvailableList = QImageReader::supportedImageFormats();
+		QMutex statsMutex;
+		std::map<QByteArray, DecoderRegistry::Stats> statsMap;
+
+		Registry()
+		{
+			decoderList.push_back({ "jpeg", { "jpg", "jpeg", "jpe", "jfif" },
+				[](const QByteArray &head) { return headStartsWith(head, "\xFF\xD8\xFF", 3); },
+				DecoderRegistry::decodeJpeg });
+			decoderList.push_back({ "png", { "png" },
+				[](const QByteArray &head) { return headStartsWith(head, "\x89PNG\r\n\x1A\n", 8); },
+				DecoderRegistry::decodeWhole });
+			decoderList.push_back({ "gif", { "gif" },
+				[](const QByteArray &head) { return headStartsWith(head, "GIF87a", 6) || headStartsWith(head, "GIF89a", 6); },
+				DecoderRegistry::decodeWhole });
+			decoderList.push_back({ "bmp", { "bmp", "dib" },
+				[](const QByteArray &head) { return headStartsWith(head, "BM", 2); },
+				DecoderRegistry::decodeWhole });
+			decoderList.push_back({ "webp", { "webp" },
+				[](const QByteArray &head) { return headStartsWith(head, "RIFF", 4) && headStartsWith(head, "WEBP", 4, 8); },
+				DecoderRegistry::decodeNative });
+			decoderList.push_back({ "tiff", { "tif", "tiff" },
+				[](const QByteArray &head) { return headStartsWith(head, "II*\0", 4) || headStartsWith(head, "MM\0*", 4); },
+				DecoderRegistry::decodeWhole });
+		}
+	};
+
+	Registry& registry()
+	{
+		// Made on first use, which is thread-safe.
+		static Registry registryMade;
+		return registryMade;
+	}
+}
+
+void DecoderRegistry::add(const Decoder &decoder)
+{
+	QWriteLocker locker(&registry().decoderLock);
+	for (auto& decoderAdded : registry().decoderList)
+	{
+		if (decoderAdded.format == decoder.format)
+		{
+			decoderAdded = decoder;
+			return;
+		}
+	}
+	registry().decoderList.push_back(decoder);
+}
+
+QByteArray DecoderRegistry::formatOf(const QByteArray &head)
+{
+	// The format whose signature the bytes start with, or nothing if it's none we have (or none Qt can decode).
+	QReadLocker locker(&registry().decoderLock);
+	for (auto& decoder : registry().decoderList)
+	{
+		if (decoder.sniff(head) && registry().formatAvailableList.contains(decoder.format))
+			return decoder.format;
+	}
+	return QByteArray();
+}
+
+void DecoderRegistry::readerSetup(QImageReader &reader)
+{
+	// Called once the reader has been given its file or buffer. Peeking at the first bytes leaves them there for the decoder,
+	// and setting the format means the reader goes straight to the right plugin; left to itself, it would try whichever one
+	// the file's suffix suggests first, and only look at the contents once that had failed.
+	QIODevice *device = reader.device();
+	if (!device || (!device->isOpen() && !device->open(QIODevice::ReadOnly)))
+		return;
+	const QByteArray format = formatOf(device->peek(headSize));
+	if (!format.isEmpty())
+		reader.setFormat(format);
+}
+
+QImage DecoderRegistry::decode(QImageReader &reader, const QSize &size)
+{
+	// Decodes the image at the given size (or at full size, if none is given) with its format's decode.
+	// Formats we don't have a decoder for are read the default way.
+	QElapsedTimer timer;
+	timer.start();
+	const QByteArray format = reader.format();
+	std::function<QImage(QImageReader&, const QSize&)> decodeFormat = decodeNative;
+	{
+		QReadLocker locker(&registry().decoderLock);
+		for (auto& decoder : registry().decoderList)
+		{
+			if (decoder.format == format || decoder.suffixList.contains(QString(format)))
+			{
+				decodeFormat = decoder.decode;
+				break;
+			}
+		}
+	}
+	const QImage image = decodeFormat(reader, size);
+	const double ms = timer.nsecsElapsed() / 1e6;
+
+	QMutexLocker locker(&registry().statsMutex);
+	Stats &stats = registry().statsMap[format.isEmpty() ? QByteArray("unknown") : format];
+	stats.format = format.isEmpty() ? QByteArray("unknown") : format;
+	stats.decodes++;
+	stats.msTotal += ms;
+	stats.msMax = qMax(stats.msMax, ms);
+	return image;
+}
+
+bool DecoderRegistry::isImageFile(const QString &path)
+{
+	QFile file(path);
+	return file.open(QIODevice::ReadOnly) && !formatOf(file.read(headSize)).isEmpty();
+}
+
+bool DecoderRegistry::isImageUrl(const QUrl &url)
+{
+	// A web url can't be looked into until it's been downloaded, so we go by what its path (without any query) ends in.
+	// Image urls often don't end in a suffix at all (they're served by a script), so those are given the benefit of the doubt;
+	// it's only a suffix that's plainly something else (e.g. .html) that turns one away.
+	if (url.isLocalFile())
+		return isImageFile(url.toLocalFile());
+	const QString suffix = QFileInfo(url.path()).suffix().toLower();
+	if (suffix.isEmpty())
+		return true;
+	QReadLocker locker(&registry().decoderLock);
+	for (auto& decoder : registry().decoderList)
+	{
+		if (decoder.suffixList.contains(suffix) && registry().formatAvailableList.contains(decoder.format))
+			return true;
+	}
+	return false;
+}
+
+QStringList DecoderRegistry::nameFilterList()
+{
+	// Listing a folder goes by suffix, since looking inside every file would mean opening every one of them.
+	QStringList filterList;
+	QReadLocker locker(&registry().decoderLock);
+	for (auto& decoder : registry().decoderList)
+	{
+		if (!registry().formatAvailableList.contains(decoder.format))
+			continue;
+		for (auto& suffix : decoder.suffixList)
+			filterList.append("*." + suffix);
+	}
+	return filterList;
+}
+
+std::vector<DecoderRegistry::Stats> DecoderRegistry::stats()
+{
+	std::vector<Stats> statsList;
+	QMutexLocker locker(&registry().statsMutex);
+	for (auto& stats : registry().statsMap)
+		statsList.push_back(stats.second);
+	return statsList;
+}
+
+QImage DecoderRegistry::decodeJpeg(QImageReader &reader, const QSize &size)
+{
+	// libjpeg can scale by 1/2, 1/4 or 1/8 as it decodes, by only working from the low frequency DCT coefficients of each block,
+	// which costs a fraction of a full decode. Qt's plugin does this when it's given a scaled size, but then does any reduction
+	// that's left over with its own smooth scaling. So we ask for the smallest of those that's still at least the size we want
+	// (for pyramid levels 1 to 3, that's exactly the size we want), and leave anything beyond it to the resampler.
+	const QSize imageSize = reader.size();
+	if (!size.isValid() || !imageSize.isValid())
+		return reader.read();
+	int shift = 0;
+	while (shift < 3 &&
+		Slide::levelSize(imageSize, shift + 1).width() >= size.width() &&
+		Slide::levelSize(imageSize, shift + 1).height() >= size.height())
+		shift++;
+	if (shift > 0)
+		reader.setScaledSize(Slide::levelSize(imageSize, shift));
+	const QImage image = reader.read();
+	return image.isNull() || image.size() == size ? image : Resampler::scaled(image, size);
+}
+
+QImage DecoderRegistry::decodeNative(QImageReader &reader, const QSize &size)
+{
+	// For formats whose plugin scales while decoding (e.g. WebP), and ones we know nothing about, we leave the scaling to the plugin.
+	// Plugins that can't would decode at full size and fall back to Qt's own smooth scaling, so for those we use the resampler instead.
+	if (!size.isValid() || reader.supportsOption(QImageIOHandler::ScaledSize))
+	{
+		if (size.isValid())
+			reader.setScaledSize(size);
+		return reader.read();
+	}
+	return decodeWhole(reader, size);
+}
+
+QImage DecoderRegistry::decodeWhole(QImageReader &reader, const QSize &size)
+{
+	// PNG, TIFF, BMP and GIF have no way of decoding at a reduced size; the whole image is decoded, and then
+	// scaled down by the resampler, which splits the work across cores (see Resampler).
+	const QImage image = reader.read();
+	return image.isNull() || !size.isValid() || image.size() == size ? image : Resampler::scaled(image, size);
+}
@@ -0,0 +1,62 @@
+/*
+This file is part of Photo Viewport.
+	Photo Viewport is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	Photo Viewport is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with Photo Viewport.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <functional>
+#include <vector>
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+#include <QUrl>
+#include <QSize>
+#include <QImage>
+#include <QImageReader>
+
+// Knows which image formats we can open, and how best to decode each of them.
+// Formats are told apart by the first few bytes of the image (every format we handle starts with a fixed signature),
+// rather than by the file's suffix, so a .jpeg, a misnamed file or a url with a query string on the end are all recognised the same.
+// Each format has its own decode, which is where format-specific shortcuts live (see decodeJpeg), and every decode is timed
+// against its format, so the cost of each can be looked at separately. A format only counts as supported if Qt has a plugin for it.
+// More formats can be registered at startup (see add); one registered under the name of a built-in one takes its place.
+// Everything here is static and safe to use from any thread, since decoding happens on the workers.
+class DecoderRegistry
+{
+public:
+	struct Decoder
+	{
+		QByteArray format;
+		QStringList suffixList;
+		std::function<bool(const QByteArray &head)> sniff;
+		std::function<QImage(QImageReader &reader, const QSize &size)> decode;
+	};
+	struct Stats
+	{
+		QByteArray format;
+		int decodes = 0;
+		double msTotal = 0;
+		double msMax = 0;
+	};
+	static const int headSize = 16;
+	static void add(const Decoder &decoder);
+	static QByteArray formatOf(const QByteArray &head);
+	static void readerSetup(QImageReader &reader);
+	static QImage decode(QImageReader &reader, const QSize &size = QSize());
+	static bool isImageFile(const QString &path);
+	static bool isImageUrl(const QUrl &url);
+	static QStringList nameFilterList();
+	static std::vector<Stats> stats();
+	static QImage decodeJpeg(QImageReader &reader, const QSize &size);
+	static QImage decodeNative(QImageReader &reader, const QSize &size);
+	static QImage decodeWhole(QImageReader &reader, const QSize &size);
+};
@@ -0,0 +1,234 @@
+/*
+This file is part of Photo Viewport.
+	Photo Viewport is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	Photo Viewport is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with Photo Viewport.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "Filmstrip.h"
+#include <unordered_set>
+#include <QThread>
+#include "TiledImageItem.h"
+
+class Filmstrip::Task : public QRunnable
+{
+public:
+	Task(Filmstrip *filmstrip, ThumbnailIndex *thumbIndex, const Slide &slide, const int thumbSize)
+		: filmstrip(filmstrip), thumbIndex(thumbIndex), slide(slide), thumbSize(thumbSize)
+	{
+		setAutoDelete(false);
+	}
+
+	void run() override
+	{
+		// Only slides from files go in the on-disk index, since they're the only ones with something stable to key them by.
+		// Looking one up means asking the OS about the file and reading from the index, so it's done here rather than while painting.
+		// Otherwise, the reader scales while decoding where the format allows it, which for JPEG is far cheaper than a full decode.
+		// Formats that can't, we'd have to decode at full size first, so images big enough to be tiled are skipped
+		// rather than pulling gigapixels into memory for the sake of a thumbnail.
+		Trace::Scope trace("decodeThumbnail");
+		const QString indexKey = slide.source == Slide::Source::File ? ThumbnailIndex::keyOf(QFileInfo(slide.path)) : QString();
+		QImage image;
+		if (indexKey.isEmpty() || !thumbIndex->find(indexKey, image))
+		{
+			QBuffer buffer;
+			QImageReader reader;
+			slide.readerSetup(reader, buffer);
+			const QSize imageSize = reader.size();
+			if (imageSize.isValid() && (!TiledImageItem::wantsTiling(imageSize) || reader.supportsOption(QImageIOHandler::ScaledSize)))
+			{
+				if (imageSize.width() > thumbSize || imageSize.height() > thumbSize)
+					image = DecoderRegistry::decode(reader, imageSize.scaled(thumbSize, thumbSize, Qt::KeepAspectRatio).expandedTo(QSize(1, 1)));
+				else
+					image = DecoderRegistry::decode(reader);
+				image = Slide::paintReady(image);
+			}
+			if (!image.isNull() && !indexKey.isEmpty() && thumbIndex->isWritable())
+				thumbIndex->insert(indexKey, ThumbnailIndex::encode(image));
+		}
+
+		Filmstrip *filmstripTarget = filmstrip;
+		const quint64 id = slide.contentId;
+		QMetaObject::invokeMethod(filmstrip, [filmstripTarget, id, image]() {
+			filmstripTarget->thumbnailFinished(id, image);
+		}, Qt::QueuedConnection);
+	}
+
+	Filmstrip *filmstrip;
+	ThumbnailIndex *thumbIndex;
+	Slide slide;
+	int thumbSize;
+};
+
+Filmstrip::Filmstrip(const std::vector<Slide> &slideList, const QString &indexPath, QWidget *parent)
+	: QAbstractScrollArea(parent), slideList(slideList), thumbIndex(indexPath)
+{
+	// Thumbnails get half the cores at most, so they don't hold up decoding the slide the user is looking at.
+	threadPool.setMaxThreadCount(qMax(1, QThread::idealThreadCount() / 2));
+	setHorizontalScrollBarPolicy(Qt::ScrollBarAsNeeded);
+	setVerticalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+	setFocusPolicy(Qt::NoFocus);
+	this->setStyleSheet("QAbstractScrollArea{border: 0px; background-color: #000000;}");
+	this->setFixedHeight(cellSize + thumbSpacing + horizontalScrollBar()->sizeHint().height());
+	this->setSizePolicy(QSizePolicy::Expanding, QSizePolicy::Fixed);
+	hide();
+}
+
+Filmstrip::~Filmstrip()
+{
+	threadPool.clear();
+	threadPool.waitForDone();
+	for (auto& pending : taskPending)
+		delete pending.second;
+}
+
+void Filmstrip::slidesChanged()
+{
+	// There's nothing to show until something has been loaded, so the strip stays out of the way until then.
+	setVisible(!slideList.empty());
+	scrollRangeUpdate();
+	viewport()->update();
+}
+
+void Filmstrip::setCurrent(const int index)
+{
+	// The current slide is scrolled into view, if it isn't already, so the strip follows the user sliding left and right.
+	indexCurrent = index;
+	const int left = index * cellSize;
+	const int right = left + cellSize;
+	if (left < horizontalScrollBar()->value())
+		horizontalScrollBar()->setValue(left);
+	else if (right > horizontalScrollBar()->value() + viewport()->width())
+		horizontalScrollBar()->setValue(right - viewport()->width());
+	viewport()->update();
+}
+
+
+// protected
+
+void Filmstrip::paintEvent(QPaintEvent *event)
+{
+	Trace::Scope trace("paintFilmstrip");
+	QPainter painter(viewport());
+	painter.fillRect(event->rect(), Qt::black);
+	if (slideList.empty())
+		return;
+
+	const int offset = horizontalScrollBar()->value();
+	const int indexFirst = qMax(0, offset / cellSize);
+	const int indexLast = qMin(int(slideList.size()) - 1, (offset + viewport()->width()) / cellSize);
+	painter.setRenderHint(QPainter::SmoothPixmapTransform);
+	for (int index = indexFirst; index <= indexLast; index++)
+	{
+		const QRect rectThumb(index * cellSize - offset + thumbSpacing / 2, (viewport()->height() - thumbSize) / 2, thumbSize, thumbSize);
+		const QPixmap pixmap = thumbnailFor(index);
+		if (pixmap.isNull())
+			painter.fillRect(rectThumb, QColor(0x20, 0x20, 0x20));
+		else
+		{
+			// Thumbnails keep their aspect ratio, centered in their cell; small images aren't blown up.
+			QRect rectDrawn(QPoint(0, 0), pixmap.width() > thumbSize || pixmap.height() > thumbSize
+				? pixmap.size().scaled(rectThumb.size(), Qt::KeepAspectRatio)
+				: pixmap.size());
+			rectDrawn.moveCenter(rectThumb.center());
+			painter.drawPixmap(rectDrawn, pixmap);
+		}
+		if (index == indexCurrent)
+		{
+			painter.setPen(QPen(Qt::white, 2));
+			painter.drawRect(rectThumb.adjusted(-1, -1, 1, 1));
+		}
+	}
+	thumbnailCancelOutside(indexFirst, indexLast);
+}
+
+void Filmstrip::resizeEvent(QResizeEvent *event)
+{
+	QAbstractScrollArea::resizeEvent(event);
+	scrollRangeUpdate();
+}
+
+void Filmstrip::mousePressEvent(QMouseEvent *event)
+{
+	if (event->button() != Qt::LeftButton)
+		return;
+
+	const int index = (event->pos().x() + horizontalScrollBar()->value()) / cellSize;
+	if (index >= 0 && index < int(slideList.size()))
+		emit slideActivated(index);
+}
+
+void Filmstrip::wheelEvent(QWheelEvent *event)
+{
+	// The strip only scrolls sideways, so an ordinary (vertical) mouse wheel scrolls it too.
+	const int delta = event->angleDelta().x() != 0 ? event->angleDelta().x() : event->angleDelta().y();
+	horizontalScrollBar()->setValue(horizontalScrollBar()->value() - delta * cellSize / 120);
+	event->accept();
+}
+
+
+// private
+
+void Filmstrip::scrollRangeUpdate()
+{
+	horizontalScrollBar()->setRange(0, qMax(0, int(slideList.size()) * cellSize - viewport()->width()));
+	horizontalScrollBar()->setPageStep(viewport()->width());
+	horizontalScrollBar()->setSingleStep(cellSize);
+}
+
+QPixmap Filmstrip::thumbnailFor(const int index)
+{
+	// Painting only ever looks in memory; anything else (the on-disk index included) is the task's job.
+	// A slide from the web has nothing to make a thumbnail from until its download has finished.
+	const Slide &slide = slideList[index];
+	const quint64 key = PixmapCache::keyOf(slide.contentId, 0);
+	QPixmap pixmap;
+	if (thumbCache.find(key, pixmap) || taskPending.find(slide.contentId) != taskPending.end())
+		return pixmap;
+	if (slide.source == Slide::Source::Url && slide.data.isEmpty())
+		return pixmap;
+
+	Task *task = new Task(this, &thumbIndex, slide, thumbSize);
+	taskPending[slide.contentId] = task;
+	threadPool.start(task);
+	return pixmap;
+}
+
+void Filmstrip::thumbnailFinished(const quint64 id, const QImage &image)
+{
+	auto found = taskPending.find(id);
+	if (found == taskPending.end())
+		return;
+
+	delete found->second;
+	taskPending.erase(found);
+
+	// A thumbnail that fails to decode is still cached (as an empty pixmap), so we don't keep asking for it.
+	thumbCache.insert(PixmapCache::keyOf(id, 0), QPixmap::fromImage(image));
+	viewport()->update();
+}
+
+void Filmstrip::thumbnailCancelOutside(const int indexFirst, const int indexLast)
+{
+	// When the user scrolls the strip quickly, thumbnails that went past without being seen aren't worth making.
+	std::unordered_set<quint64> idVisible;
+	for (int index = indexFirst; index <= indexLast; index++)
+		idVisible.insert(slideList[index].contentId);
+	for (auto pendingIt = taskPending.begin(); pendingIt != taskPending.end();)
+	{
+		if (idVisible.find(pendingIt->first) == idVisible.end() && threadPool.tryTake(pendingIt->second))
+		{
+			delete pendingIt->second;
+			pendingIt = taskPending.erase(pendingIt);
+		}
+		else
+			++pendingIt;
+	}
+}
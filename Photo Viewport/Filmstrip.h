@@ -0,0 +1,71 @@
+/*
+This file is part of Photo Viewport.
+	Photo Viewport is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	Photo Viewport is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with Photo Viewport.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <vector>
+#include <unordered_map>
+#include <QAbstractScrollArea>
+#include <QScrollBar>
+#include <QPainter>
+#include <QPaintEvent>
+#include <QMouseEvent>
+#include <QWheelEvent>
+#include <QThreadPool>
+#include <QRunnable>
+#include "Slide.h"
+#include "PixmapCache.h"
+#include "ThumbnailIndex.h"
+#include "Trace.h"
+
+// A strip of thumbnails, one for every slide, shown under the viewport; clicking one jumps straight to that slide.
+// Only the thumbnails in view are ever drawn or looked up, so the strip costs the same with ten slides as with ten thousand.
+// A thumbnail comes from memory if we have it, then from the on-disk thumbnail index (see ThumbnailIndex),
+// and failing both, is made in the background from the slide itself and written back to the index for next time.
+// Both of the last two happen on the thumbnail workers, so painting the strip never touches the disk.
+class Filmstrip : public QAbstractScrollArea
+{
+	Q_OBJECT
+
+public:
+	Filmstrip(const std::vector<Slide> &slideList, const QString &indexPath, QWidget *parent = Q_NULLPTR);
+	~Filmstrip();
+	void slidesChanged();
+	void setCurrent(const int index);
+
+signals:
+	void slideActivated(int index);
+
+protected:
+	void paintEvent(QPaintEvent *event) override;
+	void resizeEvent(QResizeEvent *event) override;
+	void mousePressEvent(QMouseEvent *event) override;
+	void wheelEvent(QWheelEvent *event) override;
+
+private:
+	class Task;
+	const int thumbSize = 96;
+	const int thumbSpacing = 6;
+	const int cellSize = thumbSize + thumbSpacing;
+	const qint64 thumbCacheBudget = qint64(48) * 1024 * 1024;
+	const std::vector<Slide> &slideList;
+	int indexCurrent = -1;
+	ThumbnailIndex thumbIndex;
+	PixmapCache thumbCache = PixmapCache(thumbCacheBudget);
+	QThreadPool threadPool;
+	std::unordered_map<quint64, Task*> taskPending;
+	void scrollRangeUpdate();
+	QPixmap thumbnailFor(const int index);
+	void thumbnailFinished(const quint64 id, const QImage &image);
+	void thumbnailCancelOutside(const int indexFirst, const int indexLast);
+};
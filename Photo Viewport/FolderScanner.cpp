@@ -0,0 +1,171 @@
+/*
+This file is part of Photo Viewport.
+	Photo Viewport is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	Photo Viewport is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with Photo Viewport.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "FolderScanner.h"
+#include <algorithm>
+#include <QDirIterator>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include "Trace.h"
+#include "DecoderRegistry.h"
+
+class FolderScanner::Task : public QRunnable
+{
+public:
+	Task(FolderScanner *scanner, const quint64 scanId, const QString &dirPath, const QString &pathSkip,
+		const SortOrder order, const std::shared_ptr<std::atomic<bool>> &stopped)
+		: scanner(scanner), scanId(scanId), dirPath(dirPath), pathSkip(pathSkip), collator(FolderScanner::collatorMake()), order(order), stopped(stopped)
+	{
+		// The collator isn't shared with the GUI thread's, since collators aren't safe to use from two threads at once.
+	}
+
+	void run() override
+	{
+		// Batches are sent once they're big enough, or once enough time has passed, whichever comes first,
+		// so a slow (e.g. network) folder still fills in steadily, and a fast one doesn't flood the GUI thread.
+		// The iterator has already asked the OS about each file it lists, so its size and modification time come for free,
+		// and making its slide here (which wants both, for its content key) saves the GUI thread doing it per file.
+		Trace::Scope trace("folderScan");
+		QDirIterator dirIt(dirPath, FolderScanner::nameFilterList(), QDir::Files | QDir::NoDotAndDotDot);
+		std::vector<Entry> entryList;
+		QElapsedTimer timer;
+		timer.start();
+		bool first = true;
+		while (!*stopped.get() && dirIt.hasNext())
+		{
+			dirIt.next();
+			const QFileInfo fileInfo = dirIt.fileInfo();
+			if (fileInfo.absoluteFilePath() == pathSkip)
+				continue;
+
+			Entry entry;
+			entry.path = fileInfo.absoluteFilePath();
+			entry.name = fileInfo.fileName();
+			entry.size = fileInfo.size();
+			entry.modified = fileInfo.lastModified().toMSecsSinceEpoch();
+			entry.slide = Slide::fromFile(entry.path, entry.size, entry.modified);
+			entryList.push_back(entry);
+			if (first || entryList.size() >= batchMax || timer.elapsed() >= batchIntervalMs)
+			{
+				send(entryList, false);
+				entryList.clear();
+				timer.restart();
+				first = false;
+			}
+		}
+		send(entryList, true);
+	}
+
+	void send(std::vector<Entry> &entryList, const bool last)
+	{
+		std::sort(entryList.begin(), entryList.end(), [this](const Entry &left, const Entry &right) {
+			return FolderScanner::lessThan(collator, order, left, right);
+		});
+		FolderScanner *scannerTarget = scanner;
+		const quint64 scanIdTarget = scanId;
+		const std::vector<Entry> entryListTarget = entryList;
+		QMetaObject::invokeMethod(scanner, [scannerTarget, scanIdTarget, entryListTarget, last]() {
+			scannerTarget->batchFound(scanIdTarget, entryListTarget, last);
+		}, Qt::QueuedConnection);
+	}
+
+	const size_t batchMax = 1024;
+	const qint64 batchIntervalMs = 100;
+	FolderScanner *scanner;
+	quint64 scanId;
+	QString dirPath;
+	QString pathSkip;
+	QCollator collator;
+	SortOrder order;
+	std::shared_ptr<std::atomic<bool>> stopped;
+};
+
+FolderScanner::FolderScanner(QObject *parent)
+	: QObject(parent), collator(collatorMake()), stopped(std::make_shared<std::atomic<bool>>(false))
+{
+	threadPool.setMaxThreadCount(1);
+}
+
+FolderScanner::~FolderScanner()
+{
+	cancel();
+	threadPool.waitForDone();
+}
+
+QCollator FolderScanner::collatorMake()
+{
+	// Names are sorted the way a file manager would, so "img2" comes before "img10".
+	QCollator collatorMade;
+	collatorMade.setNumericMode(true);
+	collatorMade.setCaseSensitivity(Qt::CaseInsensitive);
+	return collatorMade;
+}
+
+QStringList FolderScanner::nameFilterList()
+{
+	return DecoderRegistry::nameFilterList();
+}
+
+void FolderScanner::setSortOrder(const SortOrder order)
+{
+	sortOrder = order;
+}
+
+bool FolderScanner::lessThan(const Entry &left, const Entry &right) const
+{
+	return lessThan(collator, sortOrder, left, right);
+}
+
+void FolderScanner::scan(const QString &dirPath, const QString &pathSkip)
+{
+	// A scan that's still running is abandoned; anything it had left to send is dropped, since it's for the old folder.
+	cancel();
+	stopped = std::make_shared<std::atomic<bool>>(false);
+	scanId++;
+	scanning = true;
+	threadPool.start(new Task(this, scanId, dirPath, QFileInfo(pathSkip).absoluteFilePath(), sortOrder, stopped));
+}
+
+void FolderScanner::cancel()
+{
+	*stopped.get() = true;
+	scanning = false;
+}
+
+bool FolderScanner::isScanning() const
+{
+	return scanning;
+}
+
+bool FolderScanner::lessThan(const QCollator &collator, const SortOrder order, const Entry &left, const Entry &right)
+{
+	if (order == SortOrder::Date && left.modified != right.modified)
+		return left.modified < right.modified;
+	const int compared = collator.compare(left.name, right.name);
+	return compared != 0 ? compared < 0 : left.path < right.path;
+}
+
+void FolderScanner::batchFound(const quint64 scanIdFound, const std::vector<Entry> &entryList, const bool last)
+{
+	if (scanIdFound != scanId || !scanning)
+		return;
+
+	if (!entryList.empty())
+		emit found(entryList);
+	if (last)
+	{
+		scanning = false;
+		emit finished();
+	}
+}
@@ -0,0 +1,76 @@
+/*
+This file is part of Photo Viewport.
+	Photo Viewport is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	Photo Viewport is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with Photo Viewport.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <memory>
+#include <atomic>
+#include <vector>
+#include <QObject>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QCollator>
+#include <QFileInfo>
+#include <QStringList>
+#include "Slide.h"
+
+// Lists the images in a folder on a background thread, so a folder can be the slideshow without the app waiting on it,
+// however many files it has or however slow the drive it's on. Entries are handed back in batches as they're found,
+// each batch already sorted, for the receiver to merge into what it has so far. Only what's needed to sort and
+// open each file is collected, and each entry comes with its slide already made, so the receiver only has to number it;
+// nothing is decoded. The first entry found is sent on its own, straight away.
+class FolderScanner : public QObject
+{
+	Q_OBJECT
+
+public:
+	struct Entry
+	{
+		QString path;
+		QString name;
+		qint64 size = -1;
+		qint64 modified = 0;
+		Slide slide;
+	};
+
+	enum class SortOrder
+	{
+		Name,
+		Date
+	};
+
+	FolderScanner(QObject *parent = Q_NULLPTR);
+	~FolderScanner();
+	static QStringList nameFilterList();
+	void setSortOrder(const SortOrder order);
+	bool lessThan(const Entry &left, const Entry &right) const;
+	void scan(const QString &dirPath, const QString &pathSkip);
+	void cancel();
+	bool isScanning() const;
+
+signals:
+	void found(const std::vector<FolderScanner::Entry> &entryList);
+	void finished();
+
+private:
+	class Task;
+	SortOrder sortOrder = SortOrder::Name;
+	QCollator collator;
+	QThreadPool threadPool;
+	std::shared_ptr<std::atomic<bool>> stopped;
+	quint64 scanId = 0;
+	bool scanning = false;
+	static QCollator collatorMake();
+	static bool lessThan(const QCollator &collator, const SortOrder order, const Entry &left, const Entry &right);
+	void batchFound(const quint64 scanIdFound, const std::vector<Entry> &entryList, const bool last);
+};
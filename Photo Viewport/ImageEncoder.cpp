@@ -0,0 +1,114 @@
+/*
+This file is part of Photo Viewport.
+	Photo Viewport is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	Photo Viewport is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with Photo Viewport.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "ImageEncoder.h"
+#include <QThread>
+
+class ImageEncoder::Task : public QRunnable
+{
+public:
+	Task(ImageEncoder *encoder, const quint64 batchId, const Job &job, const std::shared_ptr<std::atomic<bool>> &cancelled)
+		: encoder(encoder), batchId(batchId), job(job), cancelled(cancelled)
+	{
+	}
+
+	void run() override
+	{
+		// Cancelling is checked before starting and again before the file is moved into place,
+		// since encoding is the slow part and there's no stopping it partway through.
+		Trace::Scope trace("encode");
+		bool ok = false;
+		if (!*cancelled.get())
+		{
+			const QImage image = job.image.isNull() ? job.slide.decode() : job.image;
+			QSaveFile file(job.path);
+			ok = !image.isNull() &&
+				file.open(QIODevice::WriteOnly) &&
+				image.save(&file, job.format.constData(), job.quality) &&
+				!*cancelled.get() &&
+				file.commit();
+		}
+
+		ImageEncoder *encoderTarget = encoder;
+		const quint64 batchIdTarget = batchId;
+		QMetaObject::invokeMethod(encoder, [encoderTarget, batchIdTarget, ok]() {
+			encoderTarget->taskFinished(batchIdTarget, ok);
+		}, Qt::QueuedConnection);
+	}
+
+	ImageEncoder *encoder;
+	quint64 batchId;
+	Job job;
+	std::shared_ptr<std::atomic<bool>> cancelled;
+};
+
+ImageEncoder::ImageEncoder(QObject *parent)
+	: QObject(parent)
+{
+	threadPool.setMaxThreadCount(QThread::idealThreadCount());
+}
+
+ImageEncoder::~ImageEncoder()
+{
+	// Anything still being written is abandoned (its temporary file is removed), rather than holding up closing the app.
+	for (auto& batch : batchList)
+		*batch.second.cancelled.get() = true;
+	threadPool.clear();
+	threadPool.waitForDone();
+}
+
+quint64 ImageEncoder::submit(const std::vector<Job> &jobList, const int priority)
+{
+	const quint64 batchId = batchIdNext++;
+	Batch &batch = batchList[batchId];
+	batch.total = int(jobList.size());
+	batch.cancelled = std::make_shared<std::atomic<bool>>(false);
+	for (const Job &job : jobList)
+		threadPool.start(new Task(this, batchId, job, batch.cancelled), priority);
+	if (jobList.empty())
+	{
+		batchList.erase(batchId);
+		emit finished(batchId, 0, false);
+	}
+	return batchId;
+}
+
+void ImageEncoder::cancel(const quint64 batchId)
+{
+	// Tasks still in the queue see the flag when they come up and finish straight away,
+	// so the batch still reports finishing as usual, just sooner.
+	auto found = batchList.find(batchId);
+	if (found != batchList.end())
+		*found->second.cancelled.get() = true;
+}
+
+void ImageEncoder::taskFinished(const quint64 batchId, const bool ok)
+{
+	auto found = batchList.find(batchId);
+	if (found == batchList.end())
+		return;
+
+	Batch &batch = found->second;
+	batch.done++;
+	if (!ok)
+		batch.failed++;
+	emit progressed(batchId, batch.done, batch.total);
+	if (batch.done == batch.total)
+	{
+		const int failed = batch.failed;
+		const bool cancelled = *batch.cancelled.get();
+		batchList.erase(found);
+		emit finished(batchId, failed, cancelled);
+	}
+}
@@ -0,0 +1,69 @@
+/*
+This file is part of Photo Viewport.
+	Photo Viewport is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	Photo Viewport is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with Photo Viewport.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <memory>
+#include <atomic>
+#include <vector>
+#include <unordered_map>
+#include <QObject>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QImage>
+#include <QSaveFile>
+#include "Slide.h"
+#include "Trace.h"
+
+// Encodes and writes images to disk off the GUI thread, so saving a large image doesn't freeze the app while it compresses.
+// Work is handed over in batches (a single save is a batch of one), and the images in a batch are encoded in parallel,
+// one per core. Each file is written to a temporary file first and only moved into place once it's complete,
+// so a cancelled or failed save never leaves a half-written image behind, or clobbers the file that was there.
+// An image can be given already decoded, or as the slide it comes from, in which case the worker decodes it too.
+class ImageEncoder : public QObject
+{
+	Q_OBJECT
+
+public:
+	struct Job
+	{
+		Slide slide;
+		QImage image;
+		QString path;
+		QByteArray format;
+		int quality = -1;
+	};
+
+	ImageEncoder(QObject *parent = Q_NULLPTR);
+	~ImageEncoder();
+	quint64 submit(const std::vector<Job> &jobList, const int priority = 0);
+	void cancel(const quint64 batchId);
+
+signals:
+	void progressed(quint64 batchId, int done, int total);
+	void finished(quint64 batchId, int failed, bool cancelled);
+
+private:
+	class Task;
+	struct Batch
+	{
+		int total = 0;
+		int done = 0;
+		int failed = 0;
+		std::shared_ptr<std::atomic<bool>> cancelled;
+	};
+	QThreadPool threadPool;
+	quint64 batchIdNext = 1;
+	std::unordered_map<quint64, Batch> batchList;
+	void taskFinished(const quint64 batchId, const bool ok);
+};
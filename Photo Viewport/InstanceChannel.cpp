@@ -0,0 +1,107 @@
+/*
+This file is part of Photo Viewport.
+	Photo Viewport is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	Photo Viewport is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with Photo Viewport.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "InstanceChannel.h"
+#include <memory>
+#include <QDataStream>
+#include <QCryptographicHash>
+#include <QCoreApplication>
+#include <QDir>
+
+InstanceChannel::InstanceChannel(QObject *parent)
+	: QObject(parent)
+{
+	connect(&server, &QLocalServer::newConnection, this, &InstanceChannel::clientConnected);
+}
+
+QString InstanceChannel::serverName()
+{
+	// The user's name is hashed, so the server name is safe to use as a path whatever characters it has in it.
+	const QString user = qEnvironmentVariable("USERNAME", qEnvironmentVariable("USER"));
+	return QCoreApplication::applicationName().remove(' ') + "-" +
+		QString(QCryptographicHash::hash(user.toUtf8(), QCryptographicHash::Sha1).toHex().left(16));
+}
+
+QString InstanceChannel::lockPath()
+{
+	return QDir::temp().filePath(serverName() + ".lock");
+}
+
+bool InstanceChannel::handOff(const QStringList &fileList, const int timeoutMs)
+{
+	// The message is the list of paths, preceded by its length in bytes, so the receiver knows when it has all of it.
+	QLocalSocket socket;
+	socket.connectToServer(serverName());
+	if (!socket.waitForConnected(timeoutMs))
+		return false;
+
+	QByteArray message;
+	QDataStream stream(&message, QIODevice::WriteOnly);
+	stream.setVersion(QDataStream::Qt_5_0);
+	stream << quint32(0) << fileList;
+	stream.device()->seek(0);
+	stream << quint32(message.size()) - quint32(sizeof(quint32));
+	socket.write(message);
+	if (!socket.waitForBytesWritten(timeoutMs))
+		return false;
+	socket.disconnectFromServer();
+	if (socket.state() != QLocalSocket::UnconnectedState)
+		socket.waitForDisconnected(timeoutMs);
+	return true;
+}
+
+bool InstanceChannel::listen(const int timeoutMs)
+{
+	// A server left behind by an instance that crashed (on Unix, its socket file) would stop us listening, so we clear it out
+	// and try again. But the name is only taken over once nothing answers on it: an instance that came up after our handoff
+	// failed (e.g. one that got the startup lock first, or waited it out) is alive, and removing its server would cut it off
+	// from every launch after. In that case we report failure, and the caller hands off to it instead.
+	if (server.listen(serverName()))
+		return true;
+	QLocalSocket probe;
+	probe.connectToServer(serverName());
+	if (probe.waitForConnected(timeoutMs))
+	{
+		probe.abort();
+		return false;
+	}
+	QLocalServer::removeServer(serverName());
+	return server.listen(serverName());
+}
+
+void InstanceChannel::clientConnected()
+{
+	// Messages are read as they arrive, without blocking, so the running instance carries on as normal while a handoff comes in.
+	while (QLocalSocket *socket = server.nextPendingConnection())
+	{
+		std::shared_ptr<QByteArray> received = std::make_shared<QByteArray>();
+		connect(socket, &QLocalSocket::disconnected, socket, &QObject::deleteLater);
+		connect(socket, &QLocalSocket::readyRead, this, [=]() {
+			received.get()->append(socket->readAll());
+			QDataStream stream(*received.get());
+			stream.setVersion(QDataStream::Qt_5_0);
+			quint32 length = 0;
+			stream >> length;
+			if (stream.status() != QDataStream::Ok || quint32(received.get()->size()) < sizeof(quint32) + length)
+				return;
+
+			QStringList fileList;
+			stream >> fileList;
+			received.get()->clear();
+			socket->disconnectFromServer();
+			if (!fileList.isEmpty())
+				emit filesReceived(fileList);
+		});
+	}
+}
@@ -0,0 +1,44 @@
+/*
+This file is part of Photo Viewport.
+	Photo Viewport is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	Photo Viewport is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with Photo Viewport.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <QObject>
+#include <QStringList>
+#include <QLocalServer>
+#include <QLocalSocket>
+
+// Lets a new launch of the app pass its files to the instance that's already running, instead of starting up a whole
+// second copy (its own window, and its own copy of every decoded image). The running instance listens on a local socket
+// (a named pipe on Windows), named per user so different users' instances don't see each other.
+// A launch with files connects, sends their (absolute) paths, and exits; if nothing is listening, it carries on starting up as usual.
+// Launches hold a lock file (see lockPath) from trying the handoff until they're listening, so that two started at once
+// can't both find nobody listening and then take the name from each other.
+class InstanceChannel : public QObject
+{
+	Q_OBJECT
+
+public:
+	InstanceChannel(QObject *parent = Q_NULLPTR);
+	static QString serverName();
+	static QString lockPath();
+	static bool handOff(const QStringList &fileList, const int timeoutMs = 500);
+	bool listen(const int timeoutMs = 500);
+
+signals:
+	void filesReceived(QStringList fileList);
+
+private:
+	QLocalServer server;
+	void clientConnected();
+};
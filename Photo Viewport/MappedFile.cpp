@@ -0,0 +1,110 @@
+/*
+This file is part of Photo Viewport.
+	Photo Viewport is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	Photo Viewport is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with Photo Viewport.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "MappedFile.h"
+#include <limits>
+
+std::atomic<qint64> MappedFile::bytesMin(qint64(8) * 1024 * 1024);
+
+struct MappedFile::Mapping
+{
+	QFile file;
+	uchar *data = nullptr;
+	qint64 size = 0;
+
+	Mapping(const QString &path)
+		: file(path)
+	{
+	}
+
+	~Mapping()
+	{
+		if (data)
+			file.unmap(data);
+	}
+};
+
+class MappedFile::Hold : public QObject
+{
+public:
+	// Keeps a mapping alive for as long as its parent (the buffer a reader is reading it through) is.
+	Hold(const std::shared_ptr<Mapping> &mapping, QObject *parent)
+		: QObject(parent), mapping(mapping)
+	{
+	}
+
+	std::shared_ptr<Mapping> mapping;
+};
+
+MappedFile::MappedFile(const QString &path)
+	: path(path)
+{
+}
+
+bool MappedFile::wantsMapping(const qint64 fileSize)
+{
+	// Small files are cheap enough to read normally, and we'd rather not hold a file handle open
+	// (which on Windows stops the user renaming or deleting the file) for every little image in the slideshow.
+	// A negative threshold turns mapping off altogether (see the file/mapMinMB setting).
+	const qint64 threshold = bytesMin.load();
+	return threshold >= 0 && fileSize >= threshold;
+}
+
+void MappedFile::setMapBytesMin(const qint64 bytes)
+{
+	bytesMin.store(bytes);
+}
+
+qint64 MappedFile::mapBytesMin()
+{
+	return bytesMin.load();
+}
+
+QByteArray MappedFile::bytes(QObject *holder)
+{
+	// The returned array doesn't own or copy the data; it's only valid for as long as the holder is alive.
+	// An empty array means the file couldn't be mapped, and the caller should fall back on reading it by path.
+	QMutexLocker locker(&mapMutex);
+	if (!mapping && !mapFailed)
+	{
+		// QByteArray can't address more than 2 GB, so files past that are left to be read by path.
+		auto mappingNew = std::make_shared<Mapping>(path);
+		if (mappingNew.get()->file.open(QIODevice::ReadOnly) && mappingNew.get()->file.size() < qint64(std::numeric_limits<int>::max()))
+		{
+			mappingNew.get()->size = mappingNew.get()->file.size();
+			mappingNew.get()->data = mappingNew.get()->file.map(0, mappingNew.get()->size);
+		}
+		if (mappingNew.get()->data)
+			mapping = mappingNew;
+		else
+			mapFailed = true;
+	}
+	if (!mapping)
+		return QByteArray();
+	new Hold(mapping, holder);
+	return QByteArray::fromRawData(reinterpret_cast<const char*>(mapping.get()->data), int(mapping.get()->size));
+}
+
+void MappedFile::release()
+{
+	// Readers still using the mapping keep it (and the file) open until they're done; nobody after them gets it.
+	QMutexLocker locker(&mapMutex);
+	mapping.reset();
+}
+
+bool MappedFile::isMapped() const
+{
+	QMutexLocker locker(&mapMutex);
+	return bool(mapping);
+}
@@ -0,0 +1,50 @@
+/*
+This file is part of Photo Viewport.
+	Photo Viewport is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	Photo Viewport is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with Photo Viewport.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <atomic>
+#include <memory>
+#include <QObject>
+#include <QFile>
+#include <QMutex>
+#include <QByteArray>
+
+// A read-only memory mapping of a local image file, for decoding straight out of the page cache.
+// Reading a large file the usual way copies all of it into a heap buffer before the decoder even sees it;
+// with a mapping, the decoder reads the file's pages in place, and the OS can drop them again under memory pressure
+// without us having to throw anything away, so the mapping doubles as the slide's compressed copy for later re-decodes.
+// The mapping is made the first time it's asked for (normally on a decode worker), and is shared by every copy of the slide.
+// An open mapping holds the file open, which on Windows stops the user renaming or deleting it, so it's only kept
+// while the slide's pixels are cached: the viewport releases it when they're evicted, and the next decode maps the file again.
+// Each reader using the mapping holds on to it until it's done with it, so releasing never pulls pages out from under a decode.
+class MappedFile
+{
+public:
+	MappedFile(const QString &path);
+	static bool wantsMapping(const qint64 fileSize);
+	static void setMapBytesMin(const qint64 bytes);
+	static qint64 mapBytesMin();
+	QByteArray bytes(QObject *holder);
+	void release();
+	bool isMapped() const;
+
+private:
+	struct Mapping;
+	class Hold;
+	static std::atomic<qint64> bytesMin;
+	mutable QMutex mapMutex;
+	QString path;
+	std::shared_ptr<Mapping> mapping;
+	bool mapFailed = false;
+};
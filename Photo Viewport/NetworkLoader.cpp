@@ -0,0 +1,270 @@
+/*
+This file is part of Photo Viewport.
+	Photo Viewport is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	Photo Viewport is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with Photo Viewport.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "NetworkLoader.h"
+#include <QBuffer>
+#include <QImageReader>
+#include "Slide.h"
+#include "Trace.h"
+
+class NetworkLoader::PartialDecodeTask : public QRunnable
+{
+public:
+	PartialDecodeTask(NetworkLoader *loader, const quint64 id, const QByteArray &data, const int sizeMax)
+		: loader(loader), id(id), data(data), sizeMax(sizeMax)
+	{
+	}
+
+	void run() override
+	{
+		// Decoders cope with truncated data by giving back what they could decode (e.g. the top part of a JPEG),
+		// which is exactly what we want for a preview. We decode at a reduced size, since the preview
+		// is replaced as soon as the download finishes, and we may do this several times per download.
+		Trace::Scope trace("decodePartial");
+		QBuffer buffer;
+		buffer.setData(data);
+		buffer.open(QIODevice::ReadOnly);
+		QImageReader reader(&buffer);
+		DecoderRegistry::readerSetup(reader);
+		const QSize imageSize = reader.size();
+		QImage image;
+		if (imageSize.isValid())
+		{
+			int level = 0;
+			while (Slide::levelSize(imageSize, level).width() > sizeMax || Slide::levelSize(imageSize, level).height() > sizeMax)
+				level++;
+			image = Slide::paintReady(DecoderRegistry::decode(reader, Slide::levelSize(imageSize, level)));
+		}
+
+		NetworkLoader *loaderTarget = loader;
+		const quint64 idTarget = id;
+		QMetaObject::invokeMethod(loader, [loaderTarget, idTarget, image, imageSize]() {
+			loaderTarget->partialFinished(idTarget, image, imageSize);
+		}, Qt::QueuedConnection);
+	}
+
+	NetworkLoader *loader;
+	quint64 id;
+	QByteArray data;
+	int sizeMax;
+};
+
+class NetworkLoader::ContentKeyTask : public QRunnable
+{
+public:
+	ContentKeyTask(NetworkLoader *loader, const std::vector<quint64> &idList, const QByteArray &data)
+		: loader(loader), idList(idList), data(data)
+	{
+	}
+
+	void run() override
+	{
+		Trace::Scope trace("contentKey");
+		const QString contentKey = Slide::contentKeyOf(data);
+		NetworkLoader *loaderTarget = loader;
+		const std::vector<quint64> idListTarget = idList;
+		const QByteArray dataTarget = data;
+		QMetaObject::invokeMethod(loader, [loaderTarget, idListTarget, dataTarget, contentKey]() {
+			loaderTarget->contentKeyFinished(idListTarget, dataTarget, contentKey);
+		}, Qt::QueuedConnection);
+	}
+
+	NetworkLoader *loader;
+	std::vector<quint64> idList;
+	QByteArray data;
+};
+
+NetworkLoader::NetworkLoader(const QString &cacheDirectory, QObject *parent)
+	: QObject(parent)
+{
+	QNetworkDiskCache *netCache = new QNetworkDiskCache(this);
+	netCache->setCacheDirectory(cacheDirectory);
+	netCache->setMaximumCacheSize(qint64(512) * 1024 * 1024);
+	netManager.setCache(netCache);
+	// Redirects are followed, except from https to http (FollowRedirectsAttribute, which did the same, is deprecated from Qt 5.15).
+	netManager.setRedirectPolicy(QNetworkRequest::NoLessSafeRedirectPolicy);
+	partialPool.setMaxThreadCount(1);
+}
+
+NetworkLoader::~NetworkLoader()
+{
+	partialPool.clear();
+	partialPool.waitForDone();
+	for (auto& download : downloadList)
+	{
+		if (download.second.reply)
+		{
+			download.second.reply->disconnect(this);
+			download.second.reply->abort();
+		}
+	}
+}
+
+void NetworkLoader::load(const quint64 id, const QUrl &url)
+{
+	auto leader = downloadByUrl.find(url);
+	if (leader != downloadByUrl.end())
+	{
+		downloadList[leader.value()].followerList.push_back(id);
+		downloadFollower[id] = leader.value();
+		return;
+	}
+
+	downloadByUrl.insert(url, id);
+	Download download;
+	download.url = url;
+	downloadList[id] = download;
+	downloadQueue.push_back(id);
+	downloadStart();
+}
+
+void NetworkLoader::setInFlightMax(const int count)
+{
+	inFlightLimit = qMax(1, count);
+	downloadStart();
+}
+
+int NetworkLoader::inFlightMax() const
+{
+	return inFlightLimit;
+}
+
+bool NetworkLoader::isLoading(const quint64 id) const
+{
+	return downloadList.find(downloadLeaderOf(id)) != downloadList.end();
+}
+
+int NetworkLoader::progressPercent(const quint64 id) const
+{
+	auto found = downloadList.find(downloadLeaderOf(id));
+	if (found == downloadList.end() || found->second.bytesTotal <= 0)
+		return -1;
+	return int(qint64(found->second.data.size()) * 100 / found->second.bytesTotal);
+}
+
+void NetworkLoader::downloadStart()
+{
+	while (inFlight < inFlightLimit && !downloadQueue.empty())
+	{
+		const quint64 id = downloadQueue.front();
+		downloadQueue.pop_front();
+		Download &download = downloadList[id];
+
+		// The default cache load control (prefer network) means a cached response that's still fresh is used as-is,
+		// and a stale one is revalidated with a conditional request, so the body is only sent again if it changed.
+		QNetworkRequest request(download.url);
+		download.reply = netManager.get(request);
+		download.partialTimer.start();
+		inFlight++;
+
+		connect(download.reply, &QNetworkReply::readyRead, this, [=]() { downloadReadyRead(id); });
+		connect(download.reply, &QNetworkReply::finished, this, [=]() { downloadFinished(id); });
+		connect(download.reply, &QNetworkReply::downloadProgress, this, [=](qint64 bytesReceived, qint64 bytesTotal) {
+			auto found = downloadList.find(id);
+			if (found == downloadList.end())
+				return;
+			found->second.bytesTotal = bytesTotal;
+			emit progressed(id, bytesReceived, bytesTotal);
+			for (const quint64 follower : found->second.followerList)
+				emit progressed(follower, bytesReceived, bytesTotal);
+		});
+	}
+}
+
+void NetworkLoader::downloadReadyRead(const quint64 id)
+{
+	auto found = downloadList.find(id);
+	if (found == downloadList.end())
+		return;
+
+	// The body is held in a QByteArray, whose size is an int, so a response too big for one is given up on as a failed download,
+	// rather than being allowed to overflow it. The length the server says it's sending is only a hint, so we reserve no more than
+	// a modest amount up front on its say-so, and let the array grow past that as bytes actually arrive.
+	Download &download = found->second;
+	const qint64 contentLength = download.reply->header(QNetworkRequest::ContentLengthHeader).toLongLong();
+	if (contentLength > dataBytesMax || qint64(download.data.size()) + download.reply->bytesAvailable() > dataBytesMax)
+	{
+		download.reply->abort();
+		return;
+	}
+	if (download.data.isEmpty() && contentLength > 0)
+		download.data.reserve(int(qMin(contentLength, reserveBytesMax)));
+	download.data.append(download.reply->readAll());
+
+	if (!download.partialDecoding && download.partialTimer.elapsed() >= partialIntervalMs)
+	{
+		download.partialDecoding = true;
+		download.partialTimer.restart();
+		partialPool.start(new PartialDecodeTask(this, id, download.data, partialSizeMax));
+	}
+}
+
+void NetworkLoader::downloadFinished(const quint64 id)
+{
+	auto found = downloadList.find(id);
+	if (found == downloadList.end())
+		return;
+
+	Download &download = found->second;
+	if (download.reply->error() == QNetworkReply::NoError)
+		download.data.append(download.reply->readAll());
+	const bool ok = download.reply->error() == QNetworkReply::NoError;
+	download.reply->deleteLater();
+	const QByteArray data = ok ? download.data : QByteArray();
+	const std::vector<quint64> followerList = download.followerList;
+	downloadByUrl.remove(download.url);
+	for (const quint64 follower : followerList)
+		downloadFollower.erase(follower);
+	downloadList.erase(found);
+	inFlight--;
+	downloadStart();
+
+	// Bytes that arrived are hashed on the worker (see ContentKeyTask), and handed over once that's done; a failure goes straight back.
+	std::vector<quint64> idList = followerList;
+	idList.insert(idList.begin(), id);
+	if (!data.isEmpty())
+	{
+		partialPool.start(new ContentKeyTask(this, idList, data));
+		return;
+	}
+	for (const quint64 each : idList)
+		emit loaded(each, data, QString(), ok);
+}
+
+void NetworkLoader::contentKeyFinished(const std::vector<quint64> &idList, const QByteArray &data, const QString &contentKey)
+{
+	for (const quint64 id : idList)
+		emit loaded(id, data, contentKey, true);
+}
+
+void NetworkLoader::partialFinished(const quint64 id, const QImage &image, const QSize &imageSize)
+{
+	// The download may have finished while the preview was decoding, in which case the real thing supersedes it.
+	auto found = downloadList.find(id);
+	if (found == downloadList.end())
+		return;
+
+	found->second.partialDecoding = false;
+	if (image.isNull())
+		return;
+	emit partialDecoded(id, image, imageSize);
+	for (const quint64 follower : found->second.followerList)
+		emit partialDecoded(follower, image, imageSize);
+}
+
+quint64 NetworkLoader::downloadLeaderOf(const quint64 id) const
+{
+	auto follower = downloadFollower.find(id);
+	return follower != downloadFollower.end() ? follower->second : id;
+}
@@ -0,0 +1,91 @@
+/*
+This file is part of Photo Viewport.
+	Photo Viewport is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	Photo Viewport is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with Photo Viewport.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <deque>
+#include <unordered_map>
+#include <vector>
+#include <QObject>
+#include <QHash>
+#include <QUrl>
+#include <QByteArray>
+#include <QImage>
+#include <QElapsedTimer>
+#include <QThreadPool>
+#include <QNetworkAccessManager>
+#include <QNetworkDiskCache>
+#include <QNetworkRequest>
+#include <QNetworkReply>
+
+// Downloads images for slides that come from the web.
+// Only a limited number of downloads run at once, and the rest wait their turn in the order they were asked for.
+// Bytes are collected as they arrive, and while a download is in progress we periodically decode what we have so far
+// into a preview (on a worker thread), so a slow image fills in on screen instead of appearing all at once.
+// Responses are kept in a persistent disk cache keyed by url, and revalidated with the server
+// (using the ETag/Last-Modified headers it gave us) rather than downloaded again.
+// Asking for a url that's already downloading doesn't start a second request; the new id follows the first download,
+// and is told about its progress, previews and result alongside it.
+// A finished download's content key (see Slide::contentKeyOf) is worked out on the worker thread too, before the result is
+// handed over, since hashing a large image's bytes would hold up the GUI thread.
+// The cache directory is passed in, so a loader can be pointed at a scratch directory and a local server for testing.
+class NetworkLoader : public QObject
+{
+	Q_OBJECT
+
+public:
+	NetworkLoader(const QString &cacheDirectory, QObject *parent = Q_NULLPTR);
+	~NetworkLoader();
+	void load(const quint64 id, const QUrl &url);
+	void setInFlightMax(const int count);
+	int inFlightMax() const;
+	bool isLoading(const quint64 id) const;
+	int progressPercent(const quint64 id) const;
+
+signals:
+	void progressed(quint64 id, qint64 bytesReceived, qint64 bytesTotal);
+	void partialDecoded(quint64 id, QImage image, QSize imageSize);
+	void loaded(quint64 id, QByteArray data, QString contentKey, bool ok);
+
+private:
+	struct Download
+	{
+		QUrl url;
+		QNetworkReply *reply = Q_NULLPTR;
+		QByteArray data;
+		qint64 bytesTotal = -1;
+		QElapsedTimer partialTimer;
+		bool partialDecoding = false;
+		std::vector<quint64> followerList;
+	};
+	class PartialDecodeTask;
+	class ContentKeyTask;
+	const int partialIntervalMs = 250;
+	const int partialSizeMax = 1024;
+	const qint64 reserveBytesMax = qint64(64) * 1024 * 1024;
+	const qint64 dataBytesMax = qint64(1024) * 1024 * 1024;
+	int inFlight = 0;
+	int inFlightLimit = 4;
+	QNetworkAccessManager netManager;
+	QThreadPool partialPool;
+	std::deque<quint64> downloadQueue;
+	std::unordered_map<quint64, Download> downloadList;
+	QHash<QUrl, quint64> downloadByUrl;
+	std::unordered_map<quint64, quint64> downloadFollower;
+	quint64 downloadLeaderOf(const quint64 id) const;
+	void downloadStart();
+	void downloadReadyRead(const quint64 id);
+	void downloadFinished(const quint64 id);
+	void partialFinished(const quint64 id, const QImage &image, const QSize &imageSize);
+	void contentKeyFinished(const std::vector<quint64> &idList, const QByteArray &data, const QString &contentKey);
+};
@@ -24,8 +24,42 @@ PhotoViewport::PhotoViewport(QWidget *parent)
 	// regardless of image size.
 	gridLayout.get()->setMargin(0);
 	ui.centralWidget->setLayout(gridLayout.get());
-	gridLayout.get()->addWidget(viewport.get());
+	gridLayout.get()->addWidget(viewport.get(), 0, 0);
 	viewport.get()->show();
 
+	// Started without any files to open, we pick up the slideshow from where it was left last time (see SessionFile).
+	// Sessions can be turned off in the settings file, in which case each launch starts empty, as it used to.
+	sessionEnabled = QSettings().value("session/enabled", true).toBool();
+	if (sessionEnabled && QApplication::arguments().size() <= 1)
+		viewport.get()->sessionRestore(SessionFile::pathDefault());
+
+	// The filmstrip sits under the viewport, following along as slides are added and moved between,
+	// and moving the viewport to whichever slide is clicked on.
+	// A slide may already have been opened (from the command line) before we got here, so we bring it up to date first.
+	gridLayout.get()->addWidget(filmstrip.get(), 1, 0);
+	filmstrip.get()->slidesChanged();
+	filmstrip.get()->setCurrent(viewport.get()->slideCurrentIndex());
+	connect(viewport.get(), &Viewport::slideListChanged, filmstrip.get(), &Filmstrip::slidesChanged);
+	connect(viewport.get(), &Viewport::slideCurrentChanged, filmstrip.get(), &Filmstrip::setCurrent);
+	connect(filmstrip.get(), &Filmstrip::slideActivated, viewport.get(), &Viewport::slideGoTo);
+
 	setWindowState(Qt::WindowMaximized);
 }
+
+void PhotoViewport::filesOpen(const QStringList &fileList)
+{
+	// Files handed over from another launch (see InstanceChannel) are added to the slideshow,
+	// and the window is brought forward, since the user just asked to see them.
+	viewport.get()->imgOpenFiles(fileList);
+	if (isMinimized())
+		showMaximized();
+	raise();
+	activateWindow();
+}
+
+void PhotoViewport::closeEvent(QCloseEvent *event)
+{
+	if (sessionEnabled)
+		viewport.get()->sessionSave(SessionFile::pathDefault());
+	QMainWindow::closeEvent(event);
+}
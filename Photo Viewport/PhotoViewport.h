@@ -17,7 +17,9 @@ This file is part of Photo Viewport.
 #include <QtWidgets/QMainWindow>
 #include "ui_PhotoViewport.h"
 #include "Viewport.h"
+#include "Filmstrip.h"
 #include <QGridLayout>
+#include <QCloseEvent>
 
 class PhotoViewport : public QMainWindow
 {
@@ -25,10 +27,16 @@ class PhotoViewport : public QMainWindow
 
 public:
 	PhotoViewport(QWidget *parent = Q_NULLPTR);
+	void filesOpen(const QStringList &fileList);
+
+protected:
+	void closeEvent(QCloseEvent *event) override;
 
 private:
 	Ui::PhotoViewportClass ui;
+	bool sessionEnabled = true;
 
 	std::unique_ptr<QGridLayout> gridLayout = std::make_unique<QGridLayout>();
 	std::unique_ptr<Viewport> viewport = std::make_unique<Viewport>(this);
+	std::unique_ptr<Filmstrip> filmstrip = std::make_unique<Filmstrip>(viewport.get()->slides(), QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/thumbnails.idx", this);
 };
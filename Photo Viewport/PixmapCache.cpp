@@ -0,0 +1,151 @@
+/*
+This file is part of Photo Viewport.
+	Photo Viewport is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	Photo Viewport is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with Photo Viewport.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "PixmapCache.h"
+
+PixmapCache::PixmapCache(const qint64 byteBudget)
+	: budget(byteBudget)
+{
+}
+
+quint64 PixmapCache::keyOf(const quint64 slideId, const int level)
+{
+	// Each slide can have several pixmaps cached: its full resolution decode (level 0)
+	// and the pre-filtered half, quarter, etc. size levels of its zoom pyramid.
+	return (slideId << 8) | quint64(level & 0xFF);
+}
+
+bool PixmapCache::find(const quint64 key, QPixmap &pixmap)
+{
+	auto found = entryLookup.find(key);
+	if (found == entryLookup.end())
+	{
+		counters.misses++;
+		return false;
+	}
+
+	// Front of the list is the most recently used, so a hit moves the entry there.
+	entryList.splice(entryList.begin(), entryList, found->second);
+	pixmap = found->second->pixmap;
+	counters.hits++;
+	return true;
+}
+
+bool PixmapCache::contains(const quint64 key) const
+{
+	return entryLookup.find(key) != entryLookup.end();
+}
+
+void PixmapCache::insert(const quint64 key, const QPixmap &pixmap)
+{
+	remove(key);
+	entryList.push_front(Entry{ key, pixmap, costOf(pixmap) });
+	entryLookup[key] = entryList.begin();
+	counters.bytesUsed += entryList.front().cost;
+	entryCounted(key, 1, false);
+	evictToBudget();
+}
+
+void PixmapCache::remove(const quint64 key)
+{
+	auto found = entryLookup.find(key);
+	if (found != entryLookup.end())
+	{
+		counters.bytesUsed -= found->second->cost;
+		entryCounted(key, -1, false);
+		entryList.erase(found->second);
+		entryLookup.erase(found);
+	}
+}
+
+void PixmapCache::pinSlide(const quint64 slideId)
+{
+	// The pinned slide's entries (the one on screen) are skipped over by eviction,
+	// so that background decodes coming in can't push out what the user is looking at.
+	// Nothing is pinned until a slide is, and a cache whose keys aren't slide keys (such as the tile cache, see TiledImageItem)
+	// never pins anything. The default can't be a slide id that a key could give, not even 0: a tile's key can (see tileKey).
+	slideIdPinned = slideId;
+}
+
+void PixmapCache::clear()
+{
+	entryList.clear();
+	entryLookup.clear();
+	entryCountPerSlide.clear();
+	counters.bytesUsed = 0;
+}
+
+void PixmapCache::setByteBudget(const qint64 bytes)
+{
+	budget = bytes;
+	evictToBudget();
+}
+
+qint64 PixmapCache::byteBudget() const
+{
+	return budget;
+}
+
+PixmapCache::Stats PixmapCache::stats() const
+{
+	Stats current = counters;
+	current.byteBudget = budget;
+	current.count = int(entryList.size());
+	return current;
+}
+
+void PixmapCache::setSlideEvictedHandler(const std::function<void(quint64)> &handler)
+{
+	// Called with a slide's id once the last of its cached levels has been evicted, so the owner can let go
+	// of anything else it was holding on to for the slide's sake (see MappedFile).
+	slideEvicted = handler;
+}
+
+qint64 PixmapCache::costOf(const QPixmap &pixmap)
+{
+	return qint64(pixmap.width()) * pixmap.height() * pixmap.depth() / 8;
+}
+
+void PixmapCache::evictToBudget()
+{
+	// We never evict the most recently inserted/used entry, even if it alone is over budget,
+	// since that's the one the caller is about to put on screen.
+	if (entryList.empty())
+		return;
+
+	auto entryIt = entryList.end();
+	while (counters.bytesUsed > budget && entryIt != std::next(entryList.begin()))
+	{
+		--entryIt;
+		if ((entryIt->key >> 8) == slideIdPinned)
+			continue;
+		counters.bytesUsed -= entryIt->cost;
+		entryCounted(entryIt->key, -1, true);
+		entryLookup.erase(entryIt->key);
+		entryIt = entryList.erase(entryIt);
+		counters.evictions++;
+	}
+}
+
+void PixmapCache::entryCounted(const quint64 key, const int change, const bool evicted)
+{
+	const quint64 slideId = key >> 8;
+	int &count = entryCountPerSlide[slideId];
+	count += change;
+	if (count > 0)
+		return;
+	entryCountPerSlide.erase(slideId);
+	if (evicted && slideEvicted)
+		slideEvicted(slideId);
+}
@@ -0,0 +1,68 @@
+/*
+This file is part of Photo Viewport.
+	Photo Viewport is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	Photo Viewport is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with Photo Viewport.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <list>
+#include <unordered_map>
+#include <functional>
+#include <QPixmap>
+
+// Decoded pixmaps are big (width * height * 4 bytes), so we keep them in a cache with a byte budget
+// rather than holding on to every one of them for the lifetime of the slideshow.
+// When the budget is exceeded, the least recently used pixmaps are dropped first.
+class PixmapCache
+{
+public:
+	struct Stats
+	{
+		quint64 hits = 0;
+		quint64 misses = 0;
+		quint64 evictions = 0;
+		qint64 bytesUsed = 0;
+		qint64 byteBudget = 0;
+		int count = 0;
+	};
+
+	PixmapCache(const qint64 byteBudget);
+	static quint64 keyOf(const quint64 slideId, const int level);
+	bool find(const quint64 key, QPixmap &pixmap);
+	bool contains(const quint64 key) const;
+	void insert(const quint64 key, const QPixmap &pixmap);
+	void remove(const quint64 key);
+	void pinSlide(const quint64 slideId);
+	void clear();
+	void setByteBudget(const qint64 bytes);
+	qint64 byteBudget() const;
+	Stats stats() const;
+	void setSlideEvictedHandler(const std::function<void(quint64)> &handler);
+
+private:
+	struct Entry
+	{
+		quint64 key;
+		QPixmap pixmap;
+		qint64 cost;
+	};
+	std::list<Entry> entryList;
+	std::unordered_map<quint64, std::list<Entry>::iterator> entryLookup;
+	std::unordered_map<quint64, int> entryCountPerSlide;
+	std::function<void(quint64)> slideEvicted;
+	qint64 budget;
+	static const quint64 slideIdNone = ~quint64(0);
+	quint64 slideIdPinned = slideIdNone;
+	Stats counters;
+	static qint64 costOf(const QPixmap &pixmap);
+	void entryCounted(const quint64 key, const int change, const bool evicted);
+	void evictToBudget();
+};
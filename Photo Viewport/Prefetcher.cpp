@@ -0,0 +1,119 @@
+/*
+This file is part of Photo Viewport.
+	Photo Viewport is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	Photo Viewport is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with Photo Viewport.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "Prefetcher.h"
+
+Prefetcher::Prefetcher(DecodePool &decodePool, PixmapCache &pixmapCache)
+	: decodePool(decodePool), pixmapCache(pixmapCache)
+{
+}
+
+void Prefetcher::setWindow(const int ahead, const int behind)
+{
+	this->ahead = qMax(0, ahead);
+	this->behind = qMax(0, behind);
+}
+
+int Prefetcher::windowAhead() const
+{
+	return ahead;
+}
+
+int Prefetcher::windowBehind() const
+{
+	return behind;
+}
+
+void Prefetcher::setLookahead(const int count)
+{
+	lookahead = qMax(0, count);
+}
+
+void Prefetcher::setDownloadHandler(const std::function<void(const Slide&)> &handler)
+{
+	// Called for each slide in the window that's from the web and has no bytes yet, nearest first (the current slide before any),
+	// so the owner can start (or keep waiting on) its download. The same slide is passed again on every update it's still missing.
+	downloadWanted = handler;
+}
+
+void Prefetcher::update(const std::vector<Slide> &slideList, const int indexCurrent, const std::function<int(int)> &levelFor)
+{
+	if (slideList.empty())
+		return;
+
+	if (indexLast != -1 && indexCurrent != indexLast)
+		direction = indexCurrent > indexLast ? 1 : -1;
+	indexLast = indexCurrent;
+	if (lookahead > 0)
+		direction = 1;
+	const int aheadWanted = qMax(ahead, lookahead);
+
+	// We go outward from the current slide, alternating between the direction of travel and the opposite one,
+	// so that closer slides are requested first and at a higher priority than farther ones.
+	// The current slide itself has already been requested at top priority when it was displayed.
+	// A slide that's already cached at the level we want for it, or any finer one, doesn't need decoding.
+	const int levelCurrentWanted = levelFor(indexCurrent);
+	std::unordered_set<quint64> keyWanted;
+	keyWanted.insert(PixmapCache::keyOf(slideList[indexCurrent].contentId, levelCurrentWanted));
+	auto downloadPending = [this](const Slide &slide) {
+		if (slide.source != Slide::Source::Url || !slide.data.isEmpty())
+			return false;
+		if (downloadWanted)
+			downloadWanted(slide);
+		return true;
+	};
+	downloadPending(slideList[indexCurrent]);
+	for (int distance = 1; distance <= qMax(aheadWanted, behind); distance++)
+	{
+		const int indexNear[] = {
+			distance <= aheadWanted ? indexCurrent + direction * distance : -1,
+			distance <= behind ? indexCurrent - direction * distance : -1
+		};
+		for (const int index : indexNear)
+		{
+			if (index < 0 || index >= int(slideList.size()))
+				continue;
+			const Slide &slide = slideList[index];
+			if (downloadPending(slide))
+				continue;
+			const int level = levelFor(index);
+			bool cached = false;
+			for (int levelCached = 0; levelCached <= level && !cached; levelCached++)
+				cached = pixmapCache.contains(PixmapCache::keyOf(slide.contentId, levelCached));
+			if (!cached)
+			{
+				const quint64 key = PixmapCache::keyOf(slide.contentId, level);
+				keyWanted.insert(key);
+				decodePool.request(slide, level, -distance);
+				keyRequested.insert(key);
+			}
+		}
+	}
+	for (int levelCurrent = 0; levelCurrent <= levelCurrentWanted; levelCurrent++)
+	{
+		const quint64 key = PixmapCache::keyOf(slideList[indexCurrent].contentId, levelCurrent);
+		if (decodePool.isPending(key))
+			keyRequested.insert(key);
+	}
+
+	for (auto keyIt = keyRequested.begin(); keyIt != keyRequested.end();)
+	{
+		if (!decodePool.isPending(*keyIt))
+			keyIt = keyRequested.erase(keyIt);
+		else if (keyWanted.find(*keyIt) == keyWanted.end() && decodePool.cancel(*keyIt))
+			keyIt = keyRequested.erase(keyIt);
+		else
+			++keyIt;
+	}
+}
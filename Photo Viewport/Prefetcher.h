@@ -0,0 +1,52 @@
+/*
+This file is part of Photo Viewport.
+	Photo Viewport is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	Photo Viewport is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with Photo Viewport.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <functional>
+#include <vector>
+#include <unordered_set>
+#include "Slide.h"
+#include "PixmapCache.h"
+#include "DecodePool.h"
+
+// When the user slides through the list, we want the slides they're about to reach to already be decoded.
+// The prefetcher keeps a window of slides around the current one decoding in the background:
+// more of them in the direction the user is travelling, fewer behind.
+// Anything that falls out of the window (e.g. the user reverses or jumps) and hasn't started decoding yet is cancelled.
+// Slides are prefetched at the pyramid level each of them needs at the current zoom (the owner says which, see update),
+// so zoomed out browsing only decodes previews, and slides of different sizes each get the level they'll be shown at.
+// During slideshow playback (see SlideshowPlayer), travel is always forward, and the window reaches at least as far ahead as the player asks.
+// Slides from the web that haven't been downloaded have nothing to decode; coming within the window is what starts their download.
+class Prefetcher
+{
+public:
+	Prefetcher(DecodePool &decodePool, PixmapCache &pixmapCache);
+	void setWindow(const int ahead, const int behind);
+	int windowAhead() const;
+	int windowBehind() const;
+	void setLookahead(const int count);
+	void setDownloadHandler(const std::function<void(const Slide&)> &handler);
+	void update(const std::vector<Slide> &slideList, const int indexCurrent, const std::function<int(int)> &levelFor);
+
+private:
+	DecodePool &decodePool;
+	PixmapCache &pixmapCache;
+	int ahead = 3;
+	int behind = 1;
+	int lookahead = 0;
+	int indexLast = -1;
+	int direction = 1;
+	std::unordered_set<quint64> keyRequested;
+	std::function<void(const Slide&)> downloadWanted;
+};
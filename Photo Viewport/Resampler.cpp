@@ -0,0 +1,479 @@
+/*
+This file is part of Photo Viewport.
+	Photo Viewport is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	Photo Viewport is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with Photo Viewport.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "Resampler.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <QThreadPool>
+#include <QMutex>
+#include <QWaitCondition>
+#include "Trace.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define RESAMPLER_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#else
+#define RESAMPLER_X86 0
+#endif
+
+// GCC and Clang only let us use AVX2 intrinsics in functions marked as targeting it (the rest of the build stays baseline x86-64).
+// MSVC allows them anywhere, and it's on us to only call them when the CPU has AVX2.
+#if defined(__GNUC__) || defined(__clang__)
+#define RESAMPLER_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define RESAMPLER_TARGET_AVX2
+#endif
+
+namespace
+{
+	// Weights are fixed point with 14 fractional bits, so a pair of them times a pair of 8-bit channels
+	// fits in one 32-bit sum (which is what _mm_madd_epi16 gives us), with plenty of room for the sum over every tap.
+	const int weightBits = 14;
+	const int weightOne = 1 << weightBits;
+
+	struct Coefficients
+	{
+		int tapsMax = 0;
+		std::vector<int> start;
+		std::vector<int> count;
+		std::vector<int16_t> weight;
+	};
+
+	double filterBicubic(double x)
+	{
+		// Catmull-Rom style cubic (a = -0.5), as used by most image libraries.
+		const double a = -0.5;
+		x = std::fabs(x);
+		if (x < 1.0)
+			return ((a + 2.0) * x - (a + 3.0)) * x * x + 1.0;
+		if (x < 2.0)
+			return (((x - 5.0) * x + 8.0) * x - 4.0) * a;
+		return 0.0;
+	}
+
+	double filterLanczos3(double x)
+	{
+		const double pi = 3.14159265358979323846;
+		x = std::fabs(x);
+		if (x < 1e-8)
+			return 1.0;
+		if (x >= 3.0)
+			return 0.0;
+		return 3.0 * std::sin(pi * x) * std::sin(pi * x / 3.0) / (pi * pi * x * x);
+	}
+
+	Coefficients coefficientsFor(const int sizeSource, const int sizeTarget, const Resampler::Filter filter)
+	{
+		// For each target pixel, the run of source pixels that contribute to it and how much each one does.
+		// Area averaging weighs each source pixel by how much of it falls under the target pixel's footprint.
+		// The other filters are stretched by the reduction factor when scaling down, so they average over every source pixel too.
+		// Weights are rounded to fixed point so they add up to exactly one, which keeps flat areas exactly flat.
+		const double ratio = double(sizeSource) / sizeTarget;
+		const double stretch = std::max(1.0, ratio);
+		const double support = (filter == Resampler::Filter::Area ? 0.5 : filter == Resampler::Filter::Bicubic ? 2.0 : 3.0) * stretch;
+		Coefficients coefficients;
+		coefficients.tapsMax = int(std::ceil(support)) * 2 + 1;
+		coefficients.start.resize(sizeTarget);
+		coefficients.count.resize(sizeTarget);
+		coefficients.weight.assign(size_t(sizeTarget) * coefficients.tapsMax, 0);
+
+		std::vector<double> weightReal(coefficients.tapsMax);
+		for (int index = 0; index < sizeTarget; index++)
+		{
+			const double center = (index + 0.5) * ratio;
+			const int first = std::max(0, int(std::floor(center - support)));
+			const int last = std::min(sizeSource, int(std::ceil(center + support)));
+			int count = std::min(last - first, coefficients.tapsMax);
+			double sum = 0.0;
+			for (int tap = 0; tap < count; tap++)
+			{
+				const double position = first + tap + 0.5;
+				double weight;
+				if (filter == Resampler::Filter::Area)
+				{
+					const double left = std::max(double(first + tap), center - support);
+					const double right = std::min(double(first + tap + 1), center + support);
+					weight = std::max(0.0, right - left);
+				}
+				else if (filter == Resampler::Filter::Bicubic)
+					weight = filterBicubic((position - center) / stretch);
+				else
+					weight = filterLanczos3((position - center) / stretch);
+				weightReal[tap] = weight;
+				sum += weight;
+			}
+			if (sum == 0.0)
+			{
+				weightReal[0] = sum = 1.0;
+				count = std::max(count, 1);
+			}
+
+			int16_t *weight = &coefficients.weight[size_t(index) * coefficients.tapsMax];
+			int total = 0;
+			int tapLargest = 0;
+			for (int tap = 0; tap < count; tap++)
+			{
+				weight[tap] = int16_t(std::lround(weightReal[tap] / sum * weightOne));
+				total += weight[tap];
+				if (weight[tap] > weight[tapLargest])
+					tapLargest = tap;
+			}
+			weight[tapLargest] = int16_t(weight[tapLargest] + weightOne - total);
+			coefficients.start[index] = first;
+			coefficients.count[index] = count;
+		}
+		return coefficients;
+	}
+
+	inline uint32_t channelsPack(const int32_t blue, const int32_t green, const int32_t red, const int32_t alpha)
+	{
+		// Ringing from the sharper filters can push a colour channel past alpha, which isn't valid premultiplied data,
+		// so colour is clamped to alpha (a no-op for opaque images, whose alpha is always 255).
+		const uint32_t a = uint32_t(std::min(255, std::max(0, alpha >> weightBits)));
+		const uint32_t r = std::min(a, uint32_t(std::min(255, std::max(0, red >> weightBits))));
+		const uint32_t g = std::min(a, uint32_t(std::min(255, std::max(0, green >> weightBits))));
+		const uint32_t b = std::min(a, uint32_t(std::min(255, std::max(0, blue >> weightBits))));
+		return (a << 24) | (r << 16) | (g << 8) | b;
+	}
+
+	inline uint32_t alphaClamp(const uint32_t pixel)
+	{
+		const uint32_t a = pixel >> 24;
+		const uint32_t r = std::min(a, (pixel >> 16) & 0xFF);
+		const uint32_t g = std::min(a, (pixel >> 8) & 0xFF);
+		const uint32_t b = std::min(a, pixel & 0xFF);
+		return (a << 24) | (r << 16) | (g << 8) | b;
+	}
+
+	void rowHorizontalScalar(const uint32_t *source, uint32_t *target, const int width, const Coefficients &coefficients)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			const uint32_t *pixel = source + coefficients.start[x];
+			const int16_t *weight = &coefficients.weight[size_t(x) * coefficients.tapsMax];
+			int32_t b = weightOne / 2, g = weightOne / 2, r = weightOne / 2, a = weightOne / 2;
+			for (int tap = 0; tap < coefficients.count[x]; tap++)
+			{
+				b += int32_t(pixel[tap] & 0xFF) * weight[tap];
+				g += int32_t((pixel[tap] >> 8) & 0xFF) * weight[tap];
+				r += int32_t((pixel[tap] >> 16) & 0xFF) * weight[tap];
+				a += int32_t(pixel[tap] >> 24) * weight[tap];
+			}
+			target[x] = channelsPack(b, g, r, a);
+		}
+	}
+
+	void rowVerticalScalar(const uint32_t *const *rowList, const int16_t *weight, const int count, uint32_t *target, const int xFirst, const int width)
+	{
+		for (int x = xFirst; x < width; x++)
+		{
+			int32_t b = weightOne / 2, g = weightOne / 2, r = weightOne / 2, a = weightOne / 2;
+			for (int tap = 0; tap < count; tap++)
+			{
+				const uint32_t pixel = rowList[tap][x];
+				b += int32_t(pixel & 0xFF) * weight[tap];
+				g += int32_t((pixel >> 8) & 0xFF) * weight[tap];
+				r += int32_t((pixel >> 16) & 0xFF) * weight[tap];
+				a += int32_t(pixel >> 24) * weight[tap];
+			}
+			target[x] = channelsPack(b, g, r, a);
+		}
+	}
+
+#if RESAMPLER_X86
+	inline __m128i weightPair(const int16_t first, const int16_t second)
+	{
+		return _mm_set1_epi32(int32_t((uint32_t(uint16_t(second)) << 16) | uint16_t(first)));
+	}
+
+	void rowHorizontalSse2(const uint32_t *source, uint32_t *target, const int width, const Coefficients &coefficients)
+	{
+		// One target pixel at a time, its four channels side by side in one register, two taps per multiply-add.
+		const __m128i zero = _mm_setzero_si128();
+		for (int x = 0; x < width; x++)
+		{
+			const uint32_t *pixel = source + coefficients.start[x];
+			const int16_t *weight = &coefficients.weight[size_t(x) * coefficients.tapsMax];
+			const int count = coefficients.count[x];
+			__m128i sum = _mm_set1_epi32(weightOne / 2);
+			int tap = 0;
+			for (; tap + 1 < count; tap += 2)
+			{
+				const __m128i pair = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(pixel + tap)), zero);
+				const __m128i interleaved = _mm_unpacklo_epi16(pair, _mm_srli_si128(pair, 8));
+				sum = _mm_add_epi32(sum, _mm_madd_epi16(interleaved, weightPair(weight[tap], weight[tap + 1])));
+			}
+			if (tap < count)
+			{
+				const __m128i single = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(int32_t(pixel[tap])), zero), zero);
+				sum = _mm_add_epi32(sum, _mm_madd_epi16(single, weightPair(weight[tap], 0)));
+			}
+			sum = _mm_srai_epi32(sum, weightBits);
+			const __m128i packed = _mm_packus_epi16(_mm_packs_epi32(sum, sum), zero);
+			target[x] = alphaClamp(uint32_t(_mm_cvtsi128_si32(packed)));
+		}
+	}
+
+	void rowVerticalSse2(const uint32_t *const *rowList, const int16_t *weight, const int count, uint32_t *target, const int xFirst, const int width)
+	{
+		// Four target pixels at a time, two source rows per multiply-add. Whatever's left at the end of the row is done one by one.
+		const __m128i zero = _mm_setzero_si128();
+		int x = xFirst;
+		for (; x + 4 <= width; x += 4)
+		{
+			__m128i sum0 = _mm_set1_epi32(weightOne / 2);
+			__m128i sum1 = sum0, sum2 = sum0, sum3 = sum0;
+			for (int tap = 0; tap < count; tap += 2)
+			{
+				const __m128i first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rowList[tap] + x));
+				const __m128i second = tap + 1 < count ? _mm_loadu_si128(reinterpret_cast<const __m128i*>(rowList[tap + 1] + x)) : zero;
+				const __m128i weights = weightPair(weight[tap], tap + 1 < count ? weight[tap + 1] : 0);
+				const __m128i firstLow = _mm_unpacklo_epi8(first, zero), firstHigh = _mm_unpackhi_epi8(first, zero);
+				const __m128i secondLow = _mm_unpacklo_epi8(second, zero), secondHigh = _mm_unpackhi_epi8(second, zero);
+				sum0 = _mm_add_epi32(sum0, _mm_madd_epi16(_mm_unpacklo_epi16(firstLow, secondLow), weights));
+				sum1 = _mm_add_epi32(sum1, _mm_madd_epi16(_mm_unpackhi_epi16(firstLow, secondLow), weights));
+				sum2 = _mm_add_epi32(sum2, _mm_madd_epi16(_mm_unpacklo_epi16(firstHigh, secondHigh), weights));
+				sum3 = _mm_add_epi32(sum3, _mm_madd_epi16(_mm_unpackhi_epi16(firstHigh, secondHigh), weights));
+			}
+			const __m128i packed = _mm_packus_epi16(
+				_mm_packs_epi32(_mm_srai_epi32(sum0, weightBits), _mm_srai_epi32(sum1, weightBits)),
+				_mm_packs_epi32(_mm_srai_epi32(sum2, weightBits), _mm_srai_epi32(sum3, weightBits))
+			);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(target + x), packed);
+			for (int pixel = x; pixel < x + 4; pixel++)
+				target[pixel] = alphaClamp(target[pixel]);
+		}
+		rowVerticalScalar(rowList, weight, count, target, x, width);
+	}
+
+	RESAMPLER_TARGET_AVX2 void rowVerticalAvx2(const uint32_t *const *rowList, const int16_t *weight, const int count, uint32_t *target, const int width)
+	{
+		// As the SSE2 version, eight pixels at a time. Unpacking works within each 128-bit half, so each sum holds
+		// one pixel from the low half and its counterpart four pixels on from the high half, and packing puts them back in order.
+		const __m256i zero = _mm256_setzero_si256();
+		int x = 0;
+		for (; x + 8 <= width; x += 8)
+		{
+			__m256i sum0 = _mm256_set1_epi32(weightOne / 2);
+			__m256i sum1 = sum0, sum2 = sum0, sum3 = sum0;
+			for (int tap = 0; tap < count; tap += 2)
+			{
+				const __m256i first = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rowList[tap] + x));
+				const __m256i second = tap + 1 < count ? _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rowList[tap + 1] + x)) : zero;
+				const __m256i weights = _mm256_set1_epi32(int32_t((uint32_t(uint16_t(tap + 1 < count ? weight[tap + 1] : 0)) << 16) | uint16_t(weight[tap])));
+				const __m256i firstLow = _mm256_unpacklo_epi8(first, zero), firstHigh = _mm256_unpackhi_epi8(first, zero);
+				const __m256i secondLow = _mm256_unpacklo_epi8(second, zero), secondHigh = _mm256_unpackhi_epi8(second, zero);
+				sum0 = _mm256_add_epi32(sum0, _mm256_madd_epi16(_mm256_unpacklo_epi16(firstLow, secondLow), weights));
+				sum1 = _mm256_add_epi32(sum1, _mm256_madd_epi16(_mm256_unpackhi_epi16(firstLow, secondLow), weights));
+				sum2 = _mm256_add_epi32(sum2, _mm256_madd_epi16(_mm256_unpacklo_epi16(firstHigh, secondHigh), weights));
+				sum3 = _mm256_add_epi32(sum3, _mm256_madd_epi16(_mm256_unpackhi_epi16(firstHigh, secondHigh), weights));
+			}
+			const __m256i packed = _mm256_packus_epi16(
+				_mm256_packs_epi32(_mm256_srai_epi32(sum0, weightBits), _mm256_srai_epi32(sum1, weightBits)),
+				_mm256_packs_epi32(_mm256_srai_epi32(sum2, weightBits), _mm256_srai_epi32(sum3, weightBits))
+			);
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(target + x), packed);
+			for (int pixel = x; pixel < x + 8; pixel++)
+				target[pixel] = alphaClamp(target[pixel]);
+		}
+		rowVerticalSse2(rowList, weight, count, target, x, width);
+	}
+#endif
+}
+
+struct Resampler::Bands
+{
+	std::function<void(int, int)> work;
+	int rows = 0;
+	int bandHeight = 0;
+	int bandCount = 0;
+	std::atomic<int> bandNext{ 0 };
+	std::atomic<int> bandDone{ 0 };
+	QMutex mutex;
+	QWaitCondition finished;
+};
+
+class Resampler::Task : public QRunnable
+{
+public:
+	Task(const std::shared_ptr<Bands> &bands)
+		: bands(bands)
+	{
+	}
+
+	void run() override
+	{
+		bandsRun(*bands.get());
+	}
+
+	std::shared_ptr<Bands> bands;
+};
+
+QImage Resampler::scaled(const QImage &image, const QSize &size, const Filter filter, const Kernel kernel)
+{
+	// Scaling is done in two passes, across each row and then down each column, into an image as wide as the target and as tall as the source.
+	// Each axis picks its own filter when asked to: area averaging when it shrinks by half or more (every source pixel counts
+	// exactly as much as it's covered, so there's no aliasing and no ringing), Lanczos for smaller reductions (sharper than bicubic
+	// where a blur would show), and bicubic for enlargement (Lanczos rings noticeably on hard edges when enlarging).
+	// Images are scaled as premultiplied ARGB (or RGB with alpha always 255), so transparent pixels don't bleed colour into their neighbours.
+	if (image.isNull() || size.isEmpty())
+		return QImage();
+	if (image.size() == size)
+		return image;
+
+	Trace::Scope trace("resample");
+	const QImage::Format format = image.hasAlphaChannel() ? QImage::Format_ARGB32_Premultiplied : QImage::Format_RGB32;
+	const QImage source = image.convertToFormat(format);
+	auto filterOf = [filter](const int sizeSource, const int sizeTarget) {
+		if (filter != Filter::Auto)
+			return filter;
+		return sizeTarget * 2 <= sizeSource ? Filter::Area : sizeTarget < sizeSource ? Filter::Lanczos3 : Filter::Bicubic;
+	};
+	const Coefficients horizontal = coefficientsFor(source.width(), size.width(), filterOf(source.width(), size.width()));
+	const Coefficients vertical = coefficientsFor(source.height(), size.height(), filterOf(source.height(), size.height()));
+
+	QImage between(size.width(), source.height(), format);
+	QImage target(size, format);
+	if (source.isNull() || between.isNull() || target.isNull())
+		return QImage();
+
+	// A kernel the CPU doesn't have is never used, even if asked for.
+	const Kernel kernelBestHere = kernelBest();
+	const Kernel kernelUsed = kernel == Kernel::Auto || int(kernel) > int(kernelBestHere) ? kernelBestHere : kernel;
+
+	// Row pointers are worked out up front, since scanLine() on a non-const image may detach, which isn't safe across threads.
+	const uchar *sourceBits = source.constBits();
+	const int sourceStride = source.bytesPerLine();
+	uchar *betweenBits = between.bits();
+	const int betweenStride = between.bytesPerLine();
+	uchar *targetBits = target.bits();
+	const int targetStride = target.bytesPerLine();
+	const int width = size.width();
+
+	rowsSplit(source.height(), qint64(width) * horizontal.tapsMax, [&](const int first, const int last) {
+		for (int y = first; y < last; y++)
+		{
+			const uint32_t *row = reinterpret_cast<const uint32_t*>(sourceBits + qint64(y) * sourceStride);
+			uint32_t *rowTarget = reinterpret_cast<uint32_t*>(betweenBits + qint64(y) * betweenStride);
+#if RESAMPLER_X86
+			if (kernelUsed != Kernel::Scalar)
+			{
+				rowHorizontalSse2(row, rowTarget, width, horizontal);
+				continue;
+			}
+#endif
+			rowHorizontalScalar(row, rowTarget, width, horizontal);
+		}
+	});
+
+	rowsSplit(size.height(), qint64(width) * vertical.tapsMax, [&](const int first, const int last) {
+		std::vector<const uint32_t*> rowList(vertical.tapsMax);
+		for (int y = first; y < last; y++)
+		{
+			const int count = vertical.count[y];
+			for (int tap = 0; tap < count; tap++)
+				rowList[tap] = reinterpret_cast<const uint32_t*>(betweenBits + qint64(vertical.start[y] + tap) * betweenStride);
+			const int16_t *weight = &vertical.weight[size_t(y) * vertical.tapsMax];
+			uint32_t *rowTarget = reinterpret_cast<uint32_t*>(targetBits + qint64(y) * targetStride);
+#if RESAMPLER_X86
+			if (kernelUsed == Kernel::Avx2)
+			{
+				rowVerticalAvx2(rowList.data(), weight, count, rowTarget, width);
+				continue;
+			}
+			if (kernelUsed == Kernel::Sse2)
+			{
+				rowVerticalSse2(rowList.data(), weight, count, rowTarget, 0, width);
+				continue;
+			}
+#endif
+			rowVerticalScalar(rowList.data(), weight, count, rowTarget, 0, width);
+		}
+	});
+	return target;
+}
+
+Resampler::Kernel Resampler::kernelBest()
+{
+	// SSE2 is part of x86-64, so it's always there. AVX2 needs checking for at runtime, along with whether the OS
+	// saves the wider registers on a context switch (which __builtin_cpu_supports checks for us on GCC/Clang).
+	static const Kernel best = []() {
+#if RESAMPLER_X86
+#if defined(_MSC_VER) && !defined(__clang__)
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] < 7)
+			return Kernel::Sse2;
+		__cpuid(info, 1);
+		const bool osSavesAvx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+		__cpuidex(info, 7, 0);
+		return osSavesAvx && (info[1] & (1 << 5)) ? Kernel::Avx2 : Kernel::Sse2;
+#else
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2") ? Kernel::Avx2 : Kernel::Sse2;
+#endif
+#else
+		return Kernel::Scalar;
+#endif
+	}();
+	return best;
+}
+
+void Resampler::rowsSplit(const int rows, const qint64 costPerRow, const std::function<void(int, int)> &work)
+{
+	// Rows are handed out in bands from a shared counter, to the global pool's threads and to the calling thread alike.
+	// The caller working through bands itself means we never wait on helpers that haven't started
+	// (we're often called from a pool thread ourselves, and the pool may be busy), and any that start late just find nothing left.
+	// Small images aren't worth the hand-off, so they're done on the calling thread alone.
+	const int threads = QThreadPool::globalInstance()->maxThreadCount();
+	if (threads <= 1 || rows * costPerRow < (1 << 20))
+	{
+		work(0, rows);
+		return;
+	}
+
+	auto bands = std::make_shared<Bands>();
+	bands.get()->work = work;
+	bands.get()->rows = rows;
+	bands.get()->bandHeight = std::max(8, rows / (threads * 4));
+	bands.get()->bandCount = (rows + bands.get()->bandHeight - 1) / bands.get()->bandHeight;
+	for (int helper = 1; helper < std::min(threads, bands.get()->bandCount); helper++)
+		QThreadPool::globalInstance()->start(new Task(bands));
+
+	bandsRun(*bands.get());
+	QMutexLocker locker(&bands.get()->mutex);
+	while (bands.get()->bandDone.load() < bands.get()->bandCount)
+		bands.get()->finished.wait(&bands.get()->mutex);
+}
+
+void Resampler::bandsRun(Bands &bands)
+{
+	for (int band = bands.bandNext++; band < bands.bandCount; band = bands.bandNext++)
+	{
+		const int first = band * bands.bandHeight;
+		bands.work(first, std::min(bands.rows, first + bands.bandHeight));
+		if (++bands.bandDone == bands.bandCount)
+		{
+			QMutexLocker locker(&bands.mutex);
+			bands.finished.wakeAll();
+		}
+	}
+}
@@ -0,0 +1,50 @@
+/*
+This file is part of Photo Viewport.
+	Photo Viewport is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	Photo Viewport is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with Photo Viewport.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <functional>
+#include <QImage>
+#include <QSize>
+
+// Scales images down (and occasionally up) with filters chosen for the size of the change,
+// using SIMD where the CPU has it and splitting large images into bands of rows across the worker threads.
+// This replaces Qt's smooth scaling, which is single threaded, and for big reductions slower and blurrier than it needs to be.
+class Resampler
+{
+public:
+	enum class Filter
+	{
+		Auto,
+		Area,
+		Bicubic,
+		Lanczos3
+	};
+
+	enum class Kernel
+	{
+		Auto,
+		Scalar,
+		Sse2,
+		Avx2
+	};
+
+	static QImage scaled(const QImage &image, const QSize &size, const Filter filter = Filter::Auto, const Kernel kernel = Kernel::Auto);
+	static Kernel kernelBest();
+
+private:
+	struct Bands;
+	class Task;
+	static void rowsSplit(const int rows, const qint64 costPerRow, const std::function<void(int, int)> &work);
+	static void bandsRun(Bands &bands);
+};
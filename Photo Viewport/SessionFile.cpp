@@ -0,0 +1,122 @@
+/*
+This file is part of Photo Viewport.
+	Photo Viewport is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	Photo Viewport is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with Photo Viewport.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "SessionFile.h"
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <QDataStream>
+#include <QStandardPaths>
+#include "Trace.h"
+
+QString SessionFile::pathDefault()
+{
+	return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/session.pvs";
+}
+
+bool SessionFile::save(const QString &filePath, const std::vector<Slide> &slideList, const View &view)
+{
+	// The whole session is put together in memory and written out in one go, through a save file,
+	// so a crash partway through leaves the last good session in place rather than half of a new one.
+	// Pasted images that were never decoded are compressed here, since their bytes are all there is to keep.
+	Trace::Scope trace("sessionSave");
+	QByteArray encoded;
+	QDataStream stream(&encoded, QIODevice::WriteOnly);
+	stream.setVersion(QDataStream::Qt_5_0);
+	stream << magic << version << quint32(slideList.size())
+		<< qint32(view.indexCurrent) << qint32(view.zoomLevel) << qint32(view.lastZoomLevel) << view.center;
+	for (auto& slide : slideList)
+	{
+		stream << quint8(slide.source);
+		if (slide.source == Slide::Source::File)
+			stream << slide.path << slide.fileSize << slide.fileModifiedMs;
+		else if (slide.source == Slide::Source::Url)
+			stream << slide.url;
+		else
+			stream << slide.bytes();
+	}
+
+	QDir().mkpath(QFileInfo(filePath).absolutePath());
+	QSaveFile file(filePath);
+	if (!file.open(QIODevice::WriteOnly) || file.write(encoded) != encoded.size())
+		return false;
+	return file.commit();
+}
+
+bool SessionFile::load(const QString &filePath, std::vector<Slide> &slideList, View &view)
+{
+	// Files aren't checked for on the way in, since that would mean going to the disk once per slide;
+	// one that's gone since the session was saved just fails to decode, the same as a broken image would.
+	// A session that can't be read (e.g. written by a different version) is ignored, and the slides read before
+	// a record that was cut short are kept.
+	Trace::Scope trace("sessionLoad");
+	QFile file(filePath);
+	if (!file.open(QIODevice::ReadOnly))
+		return false;
+	const QByteArray encoded = file.readAll();
+
+	QDataStream stream(encoded);
+	stream.setVersion(QDataStream::Qt_5_0);
+	quint32 magicRead = 0;
+	quint32 versionRead = 0;
+	quint32 count = 0;
+	qint32 indexCurrent = 0;
+	qint32 zoomLevel = 0;
+	qint32 lastZoomLevel = 0;
+	QPointF center;
+	stream >> magicRead >> versionRead >> count >> indexCurrent >> zoomLevel >> lastZoomLevel >> center;
+	if (stream.status() != QDataStream::Ok || magicRead != magic || versionRead != version)
+		return false;
+
+	slideList.reserve(slideList.size() + qMin(count, quint32(1 << 20)));
+	for (quint32 index = 0; index < count; index++)
+	{
+		quint8 source = 0;
+		stream >> source;
+		if (source == quint8(Slide::Source::File))
+		{
+			QString path;
+			qint64 fileSize = -1;
+			qint64 fileModifiedMs = -1;
+			stream >> path >> fileSize >> fileModifiedMs;
+			if (stream.status() != QDataStream::Ok)
+				break;
+			slideList.push_back(Slide::fromFile(path, fileSize, fileModifiedMs));
+		}
+		else if (source == quint8(Slide::Source::Url))
+		{
+			QUrl url;
+			stream >> url;
+			if (stream.status() != QDataStream::Ok)
+				break;
+			slideList.push_back(Slide::fromNetwork(url, QByteArray()));
+		}
+		else if (source == quint8(Slide::Source::Data))
+		{
+			QByteArray data;
+			stream >> data;
+			if (stream.status() != QDataStream::Ok)
+				break;
+			slideList.push_back(Slide::fromData(data));
+		}
+		else
+			break;
+	}
+
+	view.indexCurrent = indexCurrent;
+	view.zoomLevel = zoomLevel;
+	view.lastZoomLevel = lastZoomLevel;
+	view.center = center;
+	return true;
+}
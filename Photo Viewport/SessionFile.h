@@ -0,0 +1,42 @@
+/*
+This file is part of Photo Viewport.
+	Photo Viewport is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	Photo Viewport is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with Photo Viewport.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <vector>
+#include <QString>
+#include <QPointF>
+#include "Slide.h"
+
+// The slideshow as it was when the app was last closed, so it can be picked up again where it left off.
+// Slides are recorded by where they came from (a file's path, size and modification time, a url, or for pasted images,
+// their compressed bytes), never by their pixels, so even a session of thousands of slides is small and quick to read back.
+// Along with them go the current slide and the zoom and scroll position it was being looked at with.
+class SessionFile
+{
+public:
+	struct View
+	{
+		int indexCurrent = 0;
+		int zoomLevel = 0;
+		int lastZoomLevel = 0;
+		QPointF center;
+	};
+	static QString pathDefault();
+	static bool save(const QString &filePath, const std::vector<Slide> &slideList, const View &view);
+	static bool load(const QString &filePath, std::vector<Slide> &slideList, View &view);
+
+private:
+	static const quint32 magic = 0x50565353;
+	static const quint32 version = 1;
+};
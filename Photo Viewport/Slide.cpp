@@ -0,0 +1,274 @@
+/*
+This file is part of Photo Viewport.
+	Photo Viewport is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	Photo Viewport is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with Photo Viewport.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "Slide.h"
+#include "Resampler.h"
+#include <cstring>
+#include <QDateTime>
+
+namespace
+{
+	quint64 hashBytes(const uchar *bytes, const qint64 size, quint64 hash)
+	{
+		// FNV-1a, taken a word at a time instead of a byte at a time (so it runs at memory speed), with a shift after each
+		// multiply so the high bits feed back into the low ones. It doesn't need to stand up to anyone trying to collide it,
+		// just to tell apart the images a user happens to open, and a 64-bit hash plus the size does that.
+		const quint64 prime = 0x100000001b3ULL;
+		qint64 offset = 0;
+		for (; offset + 8 <= size; offset += 8)
+		{
+			quint64 word;
+			std::memcpy(&word, bytes + offset, sizeof(word));
+			hash = (hash ^ word) * prime;
+			hash ^= hash >> 32;
+		}
+		for (; offset < size; offset++)
+			hash = (hash ^ bytes[offset]) * prime;
+		return hash;
+	}
+
+	const quint64 hashSeed = 0xcbf29ce484222325ULL;
+}
+
+Slide Slide::fromFile(const QString &path, const qint64 fileSize, const qint64 modifiedMs)
+{
+	// Large files are decoded from a memory mapping instead of being read into a buffer (see MappedFile).
+	// The caller can pass in the file's size and modification time if it already knows them (e.g. from listing a folder),
+	// to save asking the OS again.
+	// A file's content key is its path, size and modification time rather than a hash of its bytes, since hashing
+	// would mean reading every file of a folder as it's opened. The same file opened twice is what we're looking to catch;
+	// two different files with the same bytes in them aren't worth the cost.
+	Slide slide;
+	slide.source = Source::File;
+	slide.path = path;
+	qint64 size = fileSize;
+	qint64 modified = modifiedMs;
+	if (size < 0 || modified < 0)
+	{
+		const QFileInfo fileInfo(path);
+		size = fileInfo.size();
+		modified = fileInfo.lastModified().toMSecsSinceEpoch();
+	}
+	slide.fileSize = size;
+	slide.fileModifiedMs = modified;
+	if (MappedFile::wantsMapping(size))
+		slide.mapped = std::make_shared<MappedFile>(path);
+	slide.contentKey = QString("file:%1|%2|%3").arg(QFileInfo(path).absoluteFilePath()).arg(modified).arg(size);
+	return slide;
+}
+
+Slide Slide::fromNetwork(const QUrl &url, const QByteArray &data, const QString &contentKey)
+{
+	// We hold on to the downloaded bytes as-is, since they're already compressed,
+	// and asking the network for them again on re-decode would be far slower.
+	// The bytes' content key comes with them, worked out off the GUI thread (see NetworkLoader).
+	Slide slide;
+	slide.source = Source::Url;
+	slide.url = url;
+	slide.data = data;
+	slide.contentKey = contentKey;
+	return slide;
+}
+
+Slide Slide::fromImage(const QImage &image)
+{
+	// Clipboard and drag images arrive decoded, with no file behind them.
+	// We compress them once to PNG (lossless, at a fast compression setting) so they
+	// can be evicted from the cache like any other slide and decoded again later.
+	// That happens when the slide is first read (see bytes), rather than here on the GUI thread,
+	// and until then the image is held as handed to us (QImage is implicitly shared, so that's not a copy).
+	// The content key is left empty for now; it's worked out from the PNG bytes when they're made (see pastedContentKey).
+	Slide slide;
+	slide.source = Source::Data;
+	slide.pasted = std::make_shared<Pasted>();
+	slide.pasted.get()->image = image;
+	return slide;
+}
+
+Slide Slide::fromData(const QByteArray &data)
+{
+	// Compressed bytes with nothing behind them, such as a pasted image brought back from a saved session (see SessionFile).
+	Slide slide;
+	slide.source = Source::Data;
+	slide.data = data;
+	slide.contentKey = contentKeyOf(data);
+	return slide;
+}
+
+QSize Slide::levelSize(const QSize &imageSize, const int level)
+{
+	// Level 0 is the image at full resolution, and each level after it is half the size of the one before
+	// (rounded up, so no pixels are dropped at the edges).
+	return QSize(
+		qMax(1, (imageSize.width() + (1 << level) - 1) >> level),
+		qMax(1, (imageSize.height() + (1 << level) - 1) >> level)
+	);
+}
+
+int Slide::levelClamp(const QSize &imageSize, const int level)
+{
+	// There's no point going past the level at which the image is down to a single pixel on its longest side.
+	int levelMax = 0;
+	while ((imageSize.width() >> (levelMax + 1)) > 0 || (imageSize.height() >> (levelMax + 1)) > 0)
+		levelMax++;
+	return qBound(0, level, levelMax);
+}
+
+QImage Slide::paintReady(QImage image)
+{
+	// Decoders hand back all sorts of formats (indexed for GIFs and many PNGs, RGB888, non-premultiplied ARGB),
+	// and the raster paint engine converts anything but RGB32 and premultiplied ARGB32 on the way to the screen,
+	// as QPixmap::fromImage does on the GUI thread. So the decode workers convert once, up front, to whichever of the two fits.
+	// Images with an alpha channel are very often fully opaque (most PNGs saved by cameras and screenshot tools),
+	// and those are relabelled as RGB32 (the bits are the same), since opaque pixels are copied when painted, instead of blended.
+	if (image.isNull())
+		return image;
+	if (!image.hasAlphaChannel())
+		return image.convertToFormat(QImage::Format_RGB32);
+
+	image = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+	for (int y = 0; y < image.height(); y++)
+	{
+		const QRgb *line = reinterpret_cast<const QRgb*>(image.constScanLine(y));
+		for (int x = 0; x < image.width(); x++)
+			if (qAlpha(line[x]) != 255)
+				return image;
+	}
+	image.reinterpretAsFormat(QImage::Format_RGB32);
+	return image;
+}
+
+QString Slide::contentKeyOf(const QByteArray &bytes)
+{
+	return QString("data:%1|%2").arg(hashBytes(reinterpret_cast<const uchar*>(bytes.constData()), bytes.size(), hashSeed), 16, 16, QChar('0')).arg(bytes.size());
+}
+
+QByteArray Slide::bytes() const
+{
+	// The compressed bytes the slide is decoded from, or none if it's to be read from its file (or a mapping of it, see readerSetup).
+	// A pasted image is compressed the first time anything asks.
+	if (pasted)
+	{
+		QMutexLocker locker(&pasted.get()->mutex);
+		if (pasted.get()->data.isEmpty() && !pasted.get()->image.isNull())
+		{
+			QBuffer buffer(&pasted.get()->data);
+			buffer.open(QIODevice::WriteOnly);
+			pasted.get()->image.save(&buffer, "PNG", 80);
+			pasted.get()->contentKey = contentKeyOf(pasted.get()->data);
+		}
+		return pasted.get()->data;
+	}
+	return source != Source::File ? data : QByteArray();
+}
+
+QString Slide::pastedContentKey() const
+{
+	// The content key of a pasted image, once it has been compressed (see bytes), or an empty one until then.
+	// The same PNG settings always give the same bytes for the same pixels, so the same image pasted twice gets the same key,
+	// as does one brought back from a saved session, which is kept as those bytes (see fromData).
+	if (!pasted)
+		return QString();
+	QMutexLocker locker(&pasted.get()->mutex);
+	return pasted.get()->contentKey;
+}
+
+void Slide::readerSetup(QImageReader &reader, QBuffer &buffer) const
+{
+	// Points the reader at wherever the slide's image lives, and at the plugin for the format its contents are in (see DecoderRegistry).
+	// The buffer has to outlive the reader's use of it, so the caller owns both. A large file is read through a mapping,
+	// which the buffer keeps hold of until it's destroyed, even if the slide's mapping is released in the meantime (see MappedFile).
+	const QByteArray bytes = source == Source::File && mapped ? mapped.get()->bytes(&buffer) : this->bytes();
+	if (bytes.isEmpty())
+		reader.setFileName(path);
+	else
+	{
+		buffer.setData(bytes);
+		buffer.open(QIODevice::ReadOnly);
+		reader.setDevice(&buffer);
+	}
+	DecoderRegistry::readerSetup(reader);
+}
+
+QSize Slide::imageSize() const
+{
+	// Only reads as much of the image as it takes to find its dimensions (usually just the header).
+	if (pasted)
+	{
+		QMutexLocker locker(&pasted.get()->mutex);
+		if (!pasted.get()->image.isNull())
+			return pasted.get()->image.size();
+	}
+	QBuffer buffer;
+	QImageReader reader;
+	readerSetup(reader, buffer);
+	return reader.size();
+}
+
+QSize Slide::imageSize(QImageReader &reader) const
+{
+	// The same, for a reader that's already been set up (see readerSetup), so that it can go on to decode the image as well.
+	if (pasted)
+	{
+		QMutexLocker locker(&pasted.get()->mutex);
+		if (!pasted.get()->image.isNull())
+			return pasted.get()->image.size();
+	}
+	return reader.size();
+}
+
+bool Slide::supportsAnimation(QImageReader &reader) const
+{
+	// This only tells us the format can hold more than one frame (e.g. any GIF), not that this image does.
+	// It's asked of a reader that's already been set up (see readerSetup), on the decode worker, since it means opening the image.
+	// Pasted images are kept as PNG, which Qt doesn't animate.
+	if (pasted)
+		return false;
+	return reader.supportsAnimation();
+}
+
+QImage Slide::decode(const int level) const
+{
+	QBuffer buffer;
+	QImageReader reader;
+	readerSetup(reader, buffer);
+	return decode(reader, level);
+}
+
+QImage Slide::decode(QImageReader &reader, const int level) const
+{
+	// Decoding at a level above 0 asks the reader for a scaled down image.
+	// Some formats (JPEG in particular) can do this while decoding, which is much cheaper
+	// in both time and memory than decoding at full resolution and scaling afterwards.
+	// A pasted image that's still held is used as it is the first time round (setting up the reader compressed it for next time), and then let go.
+	// The reader may already have been asked for the image's size (see imageSize), in which case the header isn't read again.
+	if (pasted)
+	{
+		QMutexLocker locker(&pasted.get()->mutex);
+		if (!pasted.get()->image.isNull())
+		{
+			const QImage image = pasted.get()->image;
+			if (!pasted.get()->data.isEmpty())
+				pasted.get()->image = QImage();
+			return level > 0 ? Resampler::scaled(image, levelSize(image.size(), level)) : image;
+		}
+	}
+	if (level > 0)
+	{
+		const QSize size = reader.size();
+		if (size.isValid())
+			return DecoderRegistry::decode(reader, levelSize(size, level));
+	}
+	return DecoderRegistry::decode(reader);
+}
@@ -0,0 +1,86 @@
+/*
+This file is part of Photo Viewport.
+	Photo Viewport is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	Photo Viewport is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with Photo Viewport.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <memory>
+#include <QString>
+#include <QUrl>
+#include <QByteArray>
+#include <QImage>
+#include <QImageReader>
+#include <QBuffer>
+#include <QFileInfo>
+#include <QMutex>
+#include "MappedFile.h"
+#include "DecoderRegistry.h"
+
+// A slide is the lightweight entry we keep in the slideshow list for every loaded image.
+// It only remembers where the image came from (a file on disk, or the compressed bytes we were handed),
+// so that the decoded pixels can live in a bounded cache and be thrown away/recreated as needed.
+struct Slide
+{
+	enum class Source
+	{
+		File,
+		Url,
+		Data
+	};
+
+	// Clipboard and drag images arrive already decoded (see fromImage). They're held as they are until first needed,
+	// and shared by every copy of the slide, so whichever copy is used first (normally on a decode worker) compresses it for all of them.
+	// The compressed bytes are hashed for the content key at the same time, and the viewport picks the key up (see pastedContentKey)
+	// when the decode comes back, so nothing is hashed on the GUI thread.
+	struct Pasted
+	{
+		QMutex mutex;
+		QImage image;
+		QByteArray data;
+		QString contentKey;
+	};
+
+	Source source = Source::File;
+	QString path;
+	qint64 fileSize = -1;
+	qint64 fileModifiedMs = -1;
+	QUrl url;
+	QByteArray data;
+	std::shared_ptr<MappedFile> mapped;
+	std::shared_ptr<Pasted> pasted;
+
+	// Every entry in the slideshow has its own id, but the same image is often opened, dropped or pasted more than once.
+	// Slides with the same content key (the same file, or the same bytes) are given the same content id,
+	// which is what decoded pixels are cached and looked up by, so repeats share one decoded copy and aren't decoded again.
+	quint64 id = 0;
+	quint64 contentId = 0;
+	QString contentKey;
+
+	static Slide fromFile(const QString &path, const qint64 fileSize = -1, const qint64 modifiedMs = -1);
+	static Slide fromNetwork(const QUrl &url, const QByteArray &data, const QString &contentKey = QString());
+	static Slide fromImage(const QImage &image);
+	static Slide fromData(const QByteArray &data);
+
+	static QSize levelSize(const QSize &imageSize, const int level);
+	static int levelClamp(const QSize &imageSize, const int level);
+	static QImage paintReady(QImage image);
+	static QString contentKeyOf(const QByteArray &bytes);
+
+	QByteArray bytes() const;
+	QString pastedContentKey() const;
+	void readerSetup(QImageReader &reader, QBuffer &buffer) const;
+	QSize imageSize() const;
+	QSize imageSize(QImageReader &reader) const;
+	bool supportsAnimation(QImageReader &reader) const;
+	QImage decode(const int level = 0) const;
+	QImage decode(QImageReader &reader, const int level) const;
+};
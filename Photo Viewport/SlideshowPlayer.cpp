@@ -0,0 +1,144 @@
+/*
+This file is part of Photo Viewport.
+	Photo Viewport is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	Photo Viewport is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with Photo Viewport.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "SlideshowPlayer.h"
+#include <cmath>
+
+SlideshowPlayer::SlideshowPlayer(QObject *parent)
+	: QObject(parent)
+{
+	// The default (coarse) timer type is allowed to fire up to 5% of the interval late, which for a slideshow is whole frames.
+	deadlineTimer.setSingleShot(true);
+	deadlineTimer.setTimerType(Qt::PreciseTimer);
+	connect(&deadlineTimer, &QTimer::timeout, this, [=]() {
+		due = true;
+		waitTimer.start();
+		emit advanceDue();
+	});
+	waitTimer.setSingleShot(true);
+	waitTimer.setInterval(10000);
+	connect(&waitTimer, &QTimer::timeout, this, [=]() {
+		overdue = true;
+		emit advanceDue();
+	});
+}
+
+void SlideshowPlayer::setInterval(const int ms)
+{
+	intervalMs = qMax(intervalMinMs, ms);
+}
+
+int SlideshowPlayer::interval() const
+{
+	return intervalMs;
+}
+
+void SlideshowPlayer::setWaitMax(const int ms)
+{
+	waitTimer.setInterval(qMax(0, ms));
+}
+
+int SlideshowPlayer::waitMax() const
+{
+	return waitTimer.interval();
+}
+
+void SlideshowPlayer::start()
+{
+	statsRun = Stats();
+	jitterMsTotal = 0;
+	lookaheadExtra = 0;
+	due = false;
+	overdue = false;
+	clock.start();
+	deadlineMs = intervalMs;
+	deadlineSchedule();
+}
+
+void SlideshowPlayer::stop()
+{
+	deadlineTimer.stop();
+	waitTimer.stop();
+	clock.invalidate();
+	due = false;
+	overdue = false;
+}
+
+bool SlideshowPlayer::isPlaying() const
+{
+	return clock.isValid();
+}
+
+bool SlideshowPlayer::isDue() const
+{
+	return due;
+}
+
+bool SlideshowPlayer::isOverdue() const
+{
+	return overdue;
+}
+
+void SlideshowPlayer::advanced(const bool ready)
+{
+	// How far off the deadline we were is recorded whichever way it went (timers can fire a little early, too).
+	// Anything later than a frame's worth is a miss. An advance made without the slide being ready (see isOverdue) is one as well.
+	if (!isPlaying() || !due)
+		return;
+
+	due = false;
+	overdue = false;
+	waitTimer.stop();
+	if (!ready)
+		statsRun.advancesUnready++;
+	const double lateMs = clock.nsecsElapsed() / 1e6 - deadlineMs;
+	statsRun.advances++;
+	jitterMsTotal += std::abs(lateMs);
+	statsRun.jitterMsMean = jitterMsTotal / statsRun.advances;
+	statsRun.lateMsMax = qMax(statsRun.lateMsMax, lateMs);
+	if (lateMs > missToleranceMs)
+	{
+		statsRun.deadlinesMissed++;
+		lookaheadExtra = qMin(lookaheadExtra + 1, lookaheadMax);
+		deadlineMs = clock.elapsed() + intervalMs;
+	}
+	else
+		deadlineMs += intervalMs;
+	deadlineSchedule();
+}
+
+void SlideshowPlayer::decodeTimed(const double ms)
+{
+	// A moving average, so one unusually big image doesn't throw the lookahead around on its own.
+	decodeMsEstimate = decodeMsEstimate == 0 ? ms : decodeMsEstimate * 0.8 + ms * 0.2;
+}
+
+int SlideshowPlayer::lookahead() const
+{
+	// Enough slides to cover a decode taking as long as they've been taking, with one to spare.
+	const int lookaheadDecode = 1 + int(std::ceil(decodeMsEstimate / intervalMs));
+	return qMin(lookaheadMax, lookaheadDecode + lookaheadExtra);
+}
+
+SlideshowPlayer::Stats SlideshowPlayer::stats() const
+{
+	Stats stats = statsRun;
+	stats.lookahead = lookahead();
+	return stats;
+}
+
+void SlideshowPlayer::deadlineSchedule()
+{
+	deadlineTimer.start(int(qMax<qint64>(0, deadlineMs - clock.elapsed())));
+}
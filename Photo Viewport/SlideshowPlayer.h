@@ -0,0 +1,78 @@
+/*
+This file is part of Photo Viewport.
+	Photo Viewport is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	Photo Viewport is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with Photo Viewport.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <QObject>
+#include <QTimer>
+#include <QElapsedTimer>
+
+// Advances the slideshow on its own, at a set interval, for as long as it's playing.
+// Every advance has a deadline, and deadlines are laid out from when playback started rather than from the last advance,
+// so the small delays of each one don't add up over a long show. The player only says when an advance is due;
+// the viewport checks that the next slide is ready, moves on to it, and then tells the player it has (see advanced).
+// If the next slide isn't ready yet, the advance waits for it rather than putting up an empty viewport. That counts as
+// a missed deadline, and the schedule carries on from when the advance actually happened, so we don't rush through the next few.
+// The wait is bounded, though: once an advance is overdue by the longest wait (see setWaitMax), the viewport moves on anyway
+// (see isOverdue), so a slide that's never going to be ready can't hold up the show. Those advances are counted separately.
+// How many slides ahead should already be decoding (the lookahead) follows how long decodes are taking compared to the interval,
+// and goes up by one more for each missed deadline, so a show of slow-to-decode images starts decoding further ahead.
+class SlideshowPlayer : public QObject
+{
+	Q_OBJECT
+
+public:
+	struct Stats
+	{
+		int advances = 0;
+		int deadlinesMissed = 0;
+		int advancesUnready = 0;
+		double lateMsMax = 0;
+		double jitterMsMean = 0;
+		int lookahead = 1;
+	};
+	SlideshowPlayer(QObject *parent = Q_NULLPTR);
+	void setInterval(const int ms);
+	int interval() const;
+	void setWaitMax(const int ms);
+	int waitMax() const;
+	void start();
+	void stop();
+	bool isPlaying() const;
+	bool isDue() const;
+	bool isOverdue() const;
+	void advanced(const bool ready = true);
+	void decodeTimed(const double ms);
+	int lookahead() const;
+	Stats stats() const;
+
+signals:
+	void advanceDue();
+
+private:
+	const int intervalMinMs = 100;
+	const int lookaheadMax = 16;
+	const double missToleranceMs = 16;
+	QTimer deadlineTimer;
+	QTimer waitTimer;
+	QElapsedTimer clock;
+	int intervalMs = 5000;
+	qint64 deadlineMs = 0;
+	bool due = false;
+	bool overdue = false;
+	double decodeMsEstimate = 0;
+	int lookaheadExtra = 0;
+	double jitterMsTotal = 0;
+	Stats statsRun;
+	void deadlineSchedule();
+};
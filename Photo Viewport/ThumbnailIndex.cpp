@@ -0,0 +1,191 @@
+/*
+This file is part of Photo Viewport.
+	Photo Viewport is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	Photo Viewport is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with Photo Viewport.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "ThumbnailIndex.h"
+#include <QDir>
+#include <QBuffer>
+#include <QDataStream>
+#include <QDateTime>
+#include <QSaveFile>
+
+ThumbnailIndex::ThumbnailIndex(const QString &filePath)
+	: lockFile(filePath + ".lock"), file(filePath)
+{
+	// If the index can't be opened, we carry on without it; thumbnails are then just made fresh every time.
+	// One that can't be read (e.g. written by a different version) is started over, by whoever holds the lock.
+	// The lock is held for as long as we're running, so it mustn't be taken for stale just for its age;
+	// a lock left behind by a process that has since died is still recognised and taken over.
+	QDir().mkpath(QFileInfo(filePath).absolutePath());
+	lockFile.setStaleLockTime(0);
+	writable = lockFile.tryLock(0);
+	if (!file.open(writable ? QIODevice::ReadWrite : QIODevice::ReadOnly))
+		return;
+
+	if (!load())
+	{
+		recordLookup.clear();
+		recordsStale = 0;
+		if (!writable)
+			return;
+		file.resize(0);
+		headerWrite();
+	}
+	else if (writable && recordsStale > 256 && recordsStale > recordLookup.size())
+		compact();
+}
+
+ThumbnailIndex::~ThumbnailIndex()
+{
+	file.close();
+	if (writable)
+		lockFile.unlock();
+}
+
+QString ThumbnailIndex::keyOf(const QFileInfo &fileInfo)
+{
+	return fileInfo.absoluteFilePath() + '|' +
+		QString::number(fileInfo.lastModified().toMSecsSinceEpoch()) + '|' +
+		QString::number(fileInfo.size());
+}
+
+QByteArray ThumbnailIndex::encode(const QImage &image)
+{
+	// JPEG keeps thumbnails small; images with transparency go to PNG instead, so they don't end up on a black background.
+	QByteArray encoded;
+	QBuffer buffer(&encoded);
+	buffer.open(QIODevice::WriteOnly);
+	if (image.hasAlphaChannel())
+		image.save(&buffer, "PNG");
+	else
+		image.save(&buffer, "JPG", 85);
+	return encoded;
+}
+
+bool ThumbnailIndex::find(const QString &key, QImage &image)
+{
+	QMutexLocker locker(&mutex);
+	auto found = recordLookup.constFind(key);
+	if (found == recordLookup.constEnd() || !file.seek(found->offset))
+		return false;
+
+	image = QImage::fromData(file.read(found->length));
+	return !image.isNull();
+}
+
+void ThumbnailIndex::insert(const QString &key, const QByteArray &encoded)
+{
+	QMutexLocker locker(&mutex);
+	if (!writable || !file.isOpen() || encoded.isEmpty())
+		return;
+
+	if (recordLookup.contains(key))
+		recordsStale++;
+	file.seek(file.size());
+	QDataStream stream(&file);
+	stream.setVersion(QDataStream::Qt_5_0);
+	stream << key << quint32(encoded.size());
+	const qint64 offset = file.pos();
+	stream.writeRawData(encoded.constData(), encoded.size());
+	file.flush();
+	recordLookup.insert(key, Record{ offset, encoded.size() });
+}
+
+int ThumbnailIndex::count() const
+{
+	QMutexLocker locker(&mutex);
+	return recordLookup.size();
+}
+
+bool ThumbnailIndex::isWritable() const
+{
+	return writable;
+}
+
+bool ThumbnailIndex::load()
+{
+	// Each record is the key, the thumbnail's length, and then the encoded thumbnail,
+	// so going through the index only means reading the keys and seeking past everything else.
+	if (file.size() == 0)
+		return headerWrite();
+
+	QDataStream stream(&file);
+	stream.setVersion(QDataStream::Qt_5_0);
+	quint32 magicRead = 0;
+	quint32 versionRead = 0;
+	stream >> magicRead >> versionRead;
+	if (stream.status() != QDataStream::Ok || magicRead != magic || versionRead != version)
+		return false;
+
+	qint64 offsetGood = file.pos();
+	while (!stream.atEnd())
+	{
+		QString key;
+		quint32 length = 0;
+		stream >> key >> length;
+		const qint64 offset = file.pos();
+		if (stream.status() != QDataStream::Ok || offset + length > file.size() || !file.seek(offset + length))
+			break;
+		if (recordLookup.contains(key))
+			recordsStale++;
+		recordLookup.insert(key, Record{ offset, int(length) });
+		offsetGood = offset + length;
+	}
+
+	// A record that was cut short (e.g. the app was closed partway through writing it) is dropped.
+	// Read-only, it may just be one the lock holder is still writing, so it's only ignored.
+	if (writable && offsetGood < file.size())
+		file.resize(offsetGood);
+	return true;
+}
+
+void ThumbnailIndex::compact()
+{
+	// The live records are copied to a new file, which then replaces the old one.
+	// The index has to be closed for the replace to work on Windows; if the replace fails, we keep using the old one.
+	QSaveFile fileCompact(file.fileName());
+	if (!fileCompact.open(QIODevice::WriteOnly))
+		return;
+
+	QDataStream stream(&fileCompact);
+	stream.setVersion(QDataStream::Qt_5_0);
+	stream << magic << version;
+	QHash<QString, Record> lookupCompact;
+	for (auto recordIt = recordLookup.constBegin(); recordIt != recordLookup.constEnd(); ++recordIt)
+	{
+		if (!file.seek(recordIt->offset))
+			continue;
+		const QByteArray encoded = file.read(recordIt->length);
+		stream << recordIt.key() << quint32(encoded.size());
+		const qint64 offset = fileCompact.pos();
+		stream.writeRawData(encoded.constData(), encoded.size());
+		lookupCompact.insert(recordIt.key(), Record{ offset, encoded.size() });
+	}
+
+	file.close();
+	if (fileCompact.commit())
+	{
+		recordLookup = lookupCompact;
+		recordsStale = 0;
+	}
+	file.open(QIODevice::ReadWrite);
+}
+
+bool ThumbnailIndex::headerWrite()
+{
+	QDataStream stream(&file);
+	stream.setVersion(QDataStream::Qt_5_0);
+	stream << magic << version;
+	file.flush();
+	return stream.status() == QDataStream::Ok;
+}
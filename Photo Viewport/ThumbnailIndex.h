@@ -0,0 +1,61 @@
+/*
+This file is part of Photo Viewport.
+	Photo Viewport is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	Photo Viewport is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with Photo Viewport.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QMutex>
+#include <QLockFile>
+#include <QImage>
+#include <QByteArray>
+
+// A persistent store of slide thumbnails, so that reopening a large set of images doesn't mean decoding all of them again.
+// Thumbnails are kept already encoded (they're only a few kilobytes each) in a single append-only file,
+// keyed by the image's path, modification time and size, so an image that changes on disk simply misses and is redone.
+// On open, we only read through the record headers to learn where each thumbnail lives; the thumbnails themselves
+// are read when they're asked for. Replaced records are left behind as dead space, which is reclaimed on open once it outweighs the live ones.
+// Several instances of the app can be running at once, and they all share the one index, so only the process holding its lock file
+// writes to it (appending, cutting off a torn record, or compacting); any other opens it read-only, and makes its thumbnails without saving them.
+// Lookups and inserts are made from the thumbnail workers, so they're serialized here.
+class ThumbnailIndex
+{
+public:
+	ThumbnailIndex(const QString &filePath);
+	~ThumbnailIndex();
+	static QString keyOf(const QFileInfo &fileInfo);
+	static QByteArray encode(const QImage &image);
+	bool find(const QString &key, QImage &image);
+	void insert(const QString &key, const QByteArray &encoded);
+	int count() const;
+	bool isWritable() const;
+
+private:
+	struct Record
+	{
+		qint64 offset;
+		int length;
+	};
+	static const quint32 magic = 0x50565449;
+	static const quint32 version = 1;
+	mutable QMutex mutex;
+	QLockFile lockFile;
+	bool writable = false;
+	QFile file;
+	QHash<QString, Record> recordLookup;
+	int recordsStale = 0;
+	bool load();
+	void compact();
+	bool headerWrite();
+};
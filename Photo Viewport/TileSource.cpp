@@ -0,0 +1,172 @@
+/*
+This file is part of Photo Viewport.
+	Photo Viewport is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	Photo Viewport is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with Photo Viewport.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "TileSource.h"
+
+TileSource::TileSource(const Slide &slide, const QSize &imageSize, const int tileSize)
+	: slide(slide), imageSize(imageSize), tileSize(tileSize)
+{
+	// Levels keep halving until the whole image fits in a single tile.
+	while (levelSize(levels - 1).width() > tileSize || levelSize(levels - 1).height() > tileSize)
+		levels++;
+
+	QBuffer buffer;
+	QImageReader reader;
+	slide.readerSetup(reader, buffer);
+	clipSupported = reader.supportsOption(QImageIOHandler::ClipRect);
+	scaledSupported = reader.supportsOption(QImageIOHandler::ScaledSize);
+
+	// Without clipped decoding, the tile store has to be built from a single decode of the image.
+	// If the full resolution image is too large to decode in one piece, and the reader can decode straight to a smaller size,
+	// we build the store from the finest level that does fit, and leave the levels above it out.
+	// A reader that can only decode at full resolution gets no further than that; past the budget, we leave the image unavailable.
+	if (!clipSupported)
+	{
+		while (scaledSupported && levelMin < levels - 1 && !decodeFits(levelMin))
+			levelMin++;
+		if (!decodeFits(levelMin))
+			levelMin = levels;
+	}
+}
+
+TileSource::~TileSource()
+{
+	if (storeMapped)
+		store.get()->unmap(storeMapped);
+}
+
+int TileSource::levelCount() const
+{
+	return levels;
+}
+
+int TileSource::levelFinest() const
+{
+	return levelMin;
+}
+
+bool TileSource::isAvailable() const
+{
+	return levelMin < levels;
+}
+
+QSize TileSource::levelSize(const int level) const
+{
+	return Slide::levelSize(imageSize, level);
+}
+
+QRect TileSource::tileRect(const int level, const int tileX, const int tileY) const
+{
+	// In the level's own pixel coordinates.
+	return QRect(tileX * tileSize, tileY * tileSize, tileSize, tileSize)
+		.intersected(QRect(QPoint(0, 0), levelSize(level)));
+}
+
+QImage TileSource::tile(const int level, const int tileX, const int tileY)
+{
+	const QRect rect = tileRect(level, tileX, tileY);
+	if (rect.isEmpty() || level < levelMin || !isAvailable())
+		return QImage();
+
+	if (clipSupported)
+		return tileDecode(level, rect);
+
+	{
+		QMutexLocker locker(&storeMutex);
+		if (!storeAttempted)
+			storeBuild();
+	}
+	if (!storeMapped)
+		return QImage();
+
+	// Tiles are stored as raw pixels, one fixed-size slot per tile, so we can read straight out of the mapping.
+	const uchar *tileData = storeMapped + storeTileOffset(level, tileX, tileY);
+	return QImage(tileData, rect.width(), rect.height(), rect.width() * 4, QImage::Format_ARGB32_Premultiplied).copy();
+}
+
+QImage TileSource::tileDecode(const int level, const QRect &rect) const
+{
+	// The reader clips to the tile's area of the full resolution image, then scales that down to the level's size.
+	// For JPEG, scaling is done while decoding (in the DCT domain), so coarse levels are cheap.
+	const QRect rectSource = QRect(rect.x() << level, rect.y() << level, rect.width() << level, rect.height() << level)
+		.intersected(QRect(QPoint(0, 0), imageSize));
+
+	QBuffer buffer;
+	QImageReader reader;
+	slide.readerSetup(reader, buffer);
+	reader.setClipRect(rectSource);
+	reader.setScaledSize(rect.size());
+	return reader.read().convertToFormat(QImage::Format_ARGB32_Premultiplied);
+}
+
+void TileSource::storeBuild()
+{
+	storeAttempted = true;
+
+	QBuffer buffer;
+	QImageReader reader;
+	slide.readerSetup(reader, buffer);
+	// The reader does the scaling itself here (not DecoderRegistry, which for PNG decodes whole and then resamples),
+	// since its scaled read is what keeps the decode within budget (see decodeFits).
+	if (levelMin > 0)
+		reader.setScaledSize(levelSize(levelMin));
+	QImage image = reader.read().convertToFormat(QImage::Format_ARGB32_Premultiplied);
+	if (image.isNull())
+		return;
+
+	qint64 offset = 0;
+	storeLevelOffset.assign(levels, 0);
+	for (int level = levelMin; level < levels; level++)
+	{
+		const QSize size = levelSize(level);
+		storeLevelOffset[level] = offset;
+		offset += qint64((size.width() + tileSize - 1) / tileSize) * ((size.height() + tileSize - 1) / tileSize) * tileSize * tileSize * 4;
+	}
+
+	store = std::make_unique<QTemporaryFile>();
+	if (!store.get()->open() || !store.get()->resize(offset))
+		return;
+
+	for (int level = levelMin; level < levels; level++)
+	{
+		if (level > levelMin)
+			image = Resampler::scaled(image, levelSize(level), Resampler::Filter::Area);
+		const QSize size = levelSize(level);
+		for (int tileY = 0; tileY * tileSize < size.height(); tileY++)
+		{
+			for (int tileX = 0; tileX * tileSize < size.width(); tileX++)
+			{
+				const QImage tileImage = image.copy(tileRect(level, tileX, tileY));
+				store.get()->seek(storeTileOffset(level, tileX, tileY));
+				for (int y = 0; y < tileImage.height(); y++)
+					store.get()->write(reinterpret_cast<const char*>(tileImage.constScanLine(y)), tileImage.width() * 4);
+			}
+		}
+	}
+	store.get()->flush();
+	storeMapped = store.get()->map(0, offset);
+}
+
+bool TileSource::decodeFits(const int level) const
+{
+	// The decoded image and its copy in the tile format are both held for a moment, hence two lots of four bytes a pixel.
+	const QSize size = levelSize(level);
+	return qint64(size.width()) * size.height() * 8 <= decodeBytesMax;
+}
+
+qint64 TileSource::storeTileOffset(const int level, const int tileX, const int tileY) const
+{
+	const int columns = (levelSize(level).width() + tileSize - 1) / tileSize;
+	return storeLevelOffset[level] + (qint64(tileY) * columns + tileX) * tileSize * tileSize * 4;
+}
@@ -0,0 +1,65 @@
+/*
+This file is part of Photo Viewport.
+	Photo Viewport is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	Photo Viewport is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with Photo Viewport.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <memory>
+#include <vector>
+#include <QMutex>
+#include <QTemporaryFile>
+#include <QImage>
+#include <QRect>
+#include "Slide.h"
+#include "Resampler.h"
+
+// Cuts an image into fixed-size tiles at several levels of detail (full resolution, half, quarter, and so on),
+// so that only the tiles that are actually on screen ever need to be decoded and held in memory.
+// Tiles are produced on worker threads, so everything here is safe to call from any thread.
+//
+// Where the image format's reader can decode a clipped region directly (e.g. JPEG), each tile is decoded on its own.
+// Where it can't, the image is decoded once, cut into tiles for every level and written out to a temporary file,
+// which is then memory-mapped so the OS only keeps the tiles we're reading resident.
+// That one decode is held to a fixed memory budget: if the format's reader can scale while reading (PNG reads row by row
+// into the reduced image), the store starts at the finest level that fits; if it can't, and the full resolution image
+// doesn't fit, the image isn't shown at all (see isAvailable) rather than being pulled into memory whole.
+class TileSource
+{
+public:
+	TileSource(const Slide &slide, const QSize &imageSize, const int tileSize);
+	~TileSource();
+	int levelCount() const;
+	int levelFinest() const;
+	bool isAvailable() const;
+	QSize levelSize(const int level) const;
+	QRect tileRect(const int level, const int tileX, const int tileY) const;
+	QImage tile(const int level, const int tileX, const int tileY);
+
+private:
+	const Slide slide;
+	const QSize imageSize;
+	const int tileSize;
+	const qint64 decodeBytesMax = qint64(256) * 1024 * 1024;
+	int levels = 1;
+	int levelMin = 0;
+	bool clipSupported = false;
+	bool scaledSupported = false;
+	QMutex storeMutex;
+	std::unique_ptr<QTemporaryFile> store;
+	uchar *storeMapped = nullptr;
+	bool storeAttempted = false;
+	std::vector<qint64> storeLevelOffset;
+	QImage tileDecode(const int level, const QRect &rect) const;
+	bool decodeFits(const int level) const;
+	void storeBuild();
+	qint64 storeTileOffset(const int level, const int tileX, const int tileY) const;
+};
@@ -0,0 +1,219 @@
+/*
+This file is part of Photo Viewport.
+	Photo Viewport is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	Photo Viewport is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with Photo Viewport.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "TiledImageItem.h"
+
+class TiledImageItem::Task : public QRunnable
+{
+public:
+	Task(TiledImageItem *item, const int level, const int tileX, const int tileY)
+		: item(item), tileSource(item->tileSource), level(level), tileX(tileX), tileY(tileY)
+	{
+		setAutoDelete(false);
+	}
+
+	void run() override
+	{
+		Trace::Scope trace("decodeTile");
+		QImage image = tileSource.get()->tile(level, tileX, tileY);
+		TiledImageItem *itemTarget = item;
+		const quint64 key = tileKey(level, tileX, tileY);
+		QMetaObject::invokeMethod(item, [itemTarget, key, image]() {
+			itemTarget->tileFinished(key, image);
+		}, Qt::QueuedConnection);
+	}
+
+	TiledImageItem *item;
+	std::shared_ptr<TileSource> tileSource;
+	int level;
+	int tileX;
+	int tileY;
+};
+
+TiledImageItem::TiledImageItem(const Slide &slide, const QSize &imageSize, QGraphicsItem *parent)
+	: QGraphicsObject(parent), id(slide.contentId), imageSize(imageSize),
+	tileSource(std::make_shared<TileSource>(slide, imageSize, tileSize))
+{
+	// We need the exposed rect to be accurate, so that a paint only goes through the tiles it has to.
+	setFlag(QGraphicsItem::ItemUsesExtendedStyleOption);
+}
+
+TiledImageItem::~TiledImageItem()
+{
+	threadPool.clear();
+	threadPool.waitForDone();
+	for (auto& pending : taskPending)
+		delete pending.second;
+}
+
+bool TiledImageItem::wantsTiling(const QSize &imageSize)
+{
+	// Past this size, a single pixmap gets expensive enough (hundreds of megabytes and up),
+	// or runs into the platform's limits on pixmap dimensions, that tiling pays for itself.
+	return qint64(imageSize.width()) * imageSize.height() > qint64(8192) * 8192 ||
+		imageSize.width() > 16384 ||
+		imageSize.height() > 16384;
+}
+
+quint64 TiledImageItem::slideId() const
+{
+	return id;
+}
+
+bool TiledImageItem::isAvailable() const
+{
+	return tileSource.get()->isAvailable();
+}
+
+PixmapCache::Stats TiledImageItem::tileCacheStats() const
+{
+	return tileCache.stats();
+}
+
+QRectF TiledImageItem::boundingRect() const
+{
+	return QRectF(QPointF(0, 0), imageSize);
+}
+
+void TiledImageItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget)
+{
+	Trace::Scope trace("paintTiles");
+	if (!tileSource.get()->isAvailable())
+		return;
+	const int level = levelFor(option->levelOfDetailFromTransform(painter->worldTransform()));
+	const int levelCoarsest = tileSource.get()->levelCount() - 1;
+	const QSize levelSize = tileSource.get()->levelSize(level);
+	const qreal span = qreal(tileSize << level);
+	const QRectF rectExposed = option->exposedRect.intersected(boundingRect());
+	if (rectExposed.isEmpty())
+		return;
+
+	const int tileXFirst = int(rectExposed.left() / span);
+	const int tileYFirst = int(rectExposed.top() / span);
+	const int tileXLast = qMin(int(rectExposed.right() / span), (levelSize.width() - 1) / tileSize);
+	const int tileYLast = qMin(int(rectExposed.bottom() / span), (levelSize.height() - 1) / tileSize);
+	for (int tileY = tileYFirst; tileY <= tileYLast; tileY++)
+	{
+		for (int tileX = tileXFirst; tileX <= tileXLast; tileX++)
+		{
+			const QRectF rectTarget = tileRectItem(level, tileX, tileY).intersected(rectExposed);
+			if (tileDraw(painter, level, tileX, tileY, rectTarget))
+				continue;
+
+			// Coarser levels are requested at a higher priority, so there's always something
+			// on screen quickly, which is then sharpened as the finer tiles come in.
+			tileRequest(level, tileX, tileY, level);
+			bool drawn = false;
+			for (int levelCoarse = level + 1; levelCoarse <= levelCoarsest && !drawn; levelCoarse++)
+			{
+				const int shift = levelCoarse - level;
+				drawn = tileDraw(painter, levelCoarse, tileX >> shift, tileY >> shift, rectTarget);
+			}
+			if (!drawn)
+			{
+				const int shift = levelCoarsest - level;
+				tileRequest(levelCoarsest, tileX >> shift, tileY >> shift, levelCoarsest + 1);
+			}
+		}
+	}
+
+	QGraphicsView *view = widget ? qobject_cast<QGraphicsView*>(widget->parentWidget()) : Q_NULLPTR;
+	if (view)
+		tileCancelOutside(mapFromScene(view->mapToScene(view->viewport()->rect())).boundingRect(), level);
+}
+
+quint64 TiledImageItem::tileKey(const int level, const int tileX, const int tileY)
+{
+	return (quint64(level) << 48) | (quint64(tileY) << 24) | quint64(tileX);
+}
+
+QRectF TiledImageItem::tileRectItem(const int level, const int tileX, const int tileY) const
+{
+	const QRect rect = tileSource.get()->tileRect(level, tileX, tileY);
+	const qreal scale = qreal(1 << level);
+	return QRectF(rect.x() * scale, rect.y() * scale, rect.width() * scale, rect.height() * scale);
+}
+
+int TiledImageItem::levelFor(const qreal levelOfDetail) const
+{
+	// Same rule as the pixmap pyramid: the coarsest level that still has at least as many pixels as the screen shows.
+	int level = 0;
+	while (levelOfDetail <= 1.0 / (1 << (level + 1)) && level + 1 < tileSource.get()->levelCount())
+		level++;
+	return qMax(level, tileSource.get()->levelFinest());
+}
+
+bool TiledImageItem::tileDraw(QPainter *painter, const int level, const int tileX, const int tileY, const QRectF &rectTarget)
+{
+	QPixmap pixmap;
+	if (!tileCache.find(tileKey(level, tileX, tileY), pixmap) || pixmap.isNull())
+		return false;
+
+	const QRectF rectTile = tileRectItem(level, tileX, tileY);
+	const QRectF rectPart = rectTarget.intersected(rectTile);
+	const qreal scale = qreal(1 << level);
+	painter->drawPixmap(rectPart, pixmap, QRectF(
+		(rectPart.x() - rectTile.x()) / scale,
+		(rectPart.y() - rectTile.y()) / scale,
+		rectPart.width() / scale,
+		rectPart.height() / scale
+	));
+	return true;
+}
+
+void TiledImageItem::tileRequest(const int level, const int tileX, const int tileY, const int priority)
+{
+	const quint64 key = tileKey(level, tileX, tileY);
+	if (tileCache.contains(key) || taskPending.find(key) != taskPending.end())
+		return;
+
+	Task *task = new Task(this, level, tileX, tileY);
+	taskPending[key] = task;
+	threadPool.start(task, priority);
+}
+
+void TiledImageItem::tileFinished(const quint64 key, const QImage &image)
+{
+	auto found = taskPending.find(key);
+	if (found == taskPending.end())
+		return;
+
+	const QRectF rectTile = tileRectItem(found->second->level, found->second->tileX, found->second->tileY);
+	delete found->second;
+	taskPending.erase(found);
+
+	// A tile that fails to decode is still cached (as an empty pixmap), so we don't keep asking for it.
+	tileCache.insert(key, QPixmap::fromImage(image));
+	update(rectTile);
+}
+
+void TiledImageItem::tileCancelOutside(const QRectF &rectVisible, const int level)
+{
+	// Once the user has panned or zoomed away, tiles that are no longer in view, or are at a level
+	// we're no longer drawing, aren't worth decoding. The coarsest level is always kept, since it backs everything else.
+	const int levelCoarsest = tileSource.get()->levelCount() - 1;
+	for (auto pendingIt = taskPending.begin(); pendingIt != taskPending.end();)
+	{
+		Task *task = pendingIt->second;
+		const bool wanted = task->level == levelCoarsest ||
+			(task->level == level && tileRectItem(task->level, task->tileX, task->tileY).intersects(rectVisible));
+		if (!wanted && threadPool.tryTake(task))
+		{
+			delete task;
+			pendingIt = taskPending.erase(pendingIt);
+		}
+		else
+			++pendingIt;
+	}
+}
@@ -0,0 +1,64 @@
+/*
+This file is part of Photo Viewport.
+	Photo Viewport is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	Photo Viewport is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with Photo Viewport.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <memory>
+#include <unordered_map>
+#include <QGraphicsObject>
+#include <QGraphicsView>
+#include <QStyleOptionGraphicsItem>
+#include <QPainter>
+#include <QThreadPool>
+#include <QRunnable>
+#include "Slide.h"
+#include "PixmapCache.h"
+#include "TileSource.h"
+#include "Trace.h"
+
+// Stands in for the scene's QGraphicsPixmapItem when an image is too large to hold as one pixmap.
+// It's laid out in full resolution image coordinates like the pixmap item, but paints from tiles
+// at whichever level of detail matches the view's current scale, decoding only the tiles that are in view.
+// While a tile is on its way, the area is filled in from a coarser level that's already cached.
+class TiledImageItem : public QGraphicsObject
+{
+	Q_OBJECT
+
+public:
+	TiledImageItem(const Slide &slide, const QSize &imageSize, QGraphicsItem *parent = Q_NULLPTR);
+	~TiledImageItem();
+	static bool wantsTiling(const QSize &imageSize);
+	static quint64 tileKey(const int level, const int tileX, const int tileY);
+	quint64 slideId() const;
+	bool isAvailable() const;
+	PixmapCache::Stats tileCacheStats() const;
+	QRectF boundingRect() const override;
+	void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget) override;
+
+private:
+	class Task;
+	const int tileSize = 512;
+	const qint64 tileCacheBudget = qint64(192) * 1024 * 1024;
+	const quint64 id;
+	const QSize imageSize;
+	std::shared_ptr<TileSource> tileSource;
+	PixmapCache tileCache = PixmapCache(tileCacheBudget);
+	QThreadPool threadPool;
+	std::unordered_map<quint64, Task*> taskPending;
+	QRectF tileRectItem(const int level, const int tileX, const int tileY) const;
+	int levelFor(const qreal levelOfDetail) const;
+	bool tileDraw(QPainter *painter, const int level, const int tileX, const int tileY, const QRectF &rectTarget);
+	void tileRequest(const int level, const int tileX, const int tileY, const int priority);
+	void tileFinished(const quint64 key, const QImage &image);
+	void tileCancelOutside(const QRectF &rectVisible, const int level);
+};
@@ -0,0 +1,184 @@
+/*
+This file is part of Photo Viewport.
+	Photo Viewport is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	Photo Viewport is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with Photo Viewport.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "Trace.h"
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <QMutex>
+#include <QSaveFile>
+#include <QCoreApplication>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+
+namespace
+{
+	struct Event
+	{
+		const char *name;
+		qint64 startNs;
+		qint64 durationNs;
+		int threadIndex;
+	};
+
+	// Only the thread a ring belongs to ever writes to it. Exporting reads it from another thread without stopping the writer,
+	// so each slot carries a sequence number, odd while it's being written and even once it holds event number (sequence / 2 - 1).
+	// A copy is only kept if the slot held the event we expected both before and after we read it, so an event being
+	// overwritten mid-copy is dropped instead of coming out torn. The fields are atomics (relaxed) so the copy isn't a data race.
+	struct Slot
+	{
+		std::atomic<quint64> sequence{ 0 };
+		std::atomic<const char*> name{ nullptr };
+		std::atomic<qint64> startNs{ 0 };
+		std::atomic<qint64> durationNs{ 0 };
+		std::atomic<int> threadIndex{ 0 };
+	};
+
+	struct Ring
+	{
+		static const int capacity = 8192;
+		Slot slotList[capacity];
+		std::atomic<quint64> written{ 0 };
+		std::atomic<bool> inUse{ true };
+		int threadIndex = 0;
+	};
+
+	// Rings are made the first time a thread records something. When the thread exits, its ring is handed back (but kept,
+	// along with what it recorded, so an export still includes it), and the next new thread to record takes it over,
+	// carrying on from where its events left off. Pool threads come and go, so this keeps us at one ring per thread
+	// alive at once, rather than one per thread ever started. Events keep the index of the thread that recorded them.
+	QMutex ringListMutex;
+	std::vector<std::unique_ptr<Ring>> ringList;
+	int threadCount = 0;
+
+	struct RingHold
+	{
+		Ring *ring = nullptr;
+
+		~RingHold()
+		{
+			if (ring)
+				ring->inUse.store(false, std::memory_order_release);
+		}
+	};
+	thread_local RingHold ringOfThread;
+
+	Ring* ringForThread()
+	{
+		if (!ringOfThread.ring)
+		{
+			QMutexLocker locker(&ringListMutex);
+			for (auto& ring : ringList)
+			{
+				bool inUse = false;
+				if (ring.get()->inUse.compare_exchange_strong(inUse, true, std::memory_order_acquire))
+				{
+					ringOfThread.ring = ring.get();
+					break;
+				}
+			}
+			if (!ringOfThread.ring)
+			{
+				ringList.push_back(std::make_unique<Ring>());
+				ringOfThread.ring = ringList.back().get();
+			}
+			ringOfThread.ring->threadIndex = ++threadCount;
+		}
+		return ringOfThread.ring;
+	}
+}
+
+std::atomic<bool> Trace::active{ false };
+
+void Trace::setEnabled(const bool enable)
+{
+	active.store(enable, std::memory_order_relaxed);
+}
+
+qint64 Trace::now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Trace::record(const char *name, const qint64 startNs, const qint64 durationNs)
+{
+	Ring *ring = ringForThread();
+	const quint64 index = ring->written.load(std::memory_order_relaxed);
+	Slot &slot = ring->slotList[index % Ring::capacity];
+	slot.sequence.store(index * 2 + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	slot.name.store(name, std::memory_order_relaxed);
+	slot.startNs.store(startNs, std::memory_order_relaxed);
+	slot.durationNs.store(durationNs, std::memory_order_relaxed);
+	slot.threadIndex.store(ring->threadIndex, std::memory_order_relaxed);
+	slot.sequence.store(index * 2 + 2, std::memory_order_release);
+	ring->written.store(index + 1, std::memory_order_release);
+}
+
+bool Trace::exportChrome(const QString &path)
+{
+	// Complete ("X") events, with timestamps in microseconds from the earliest event we have, one track per thread.
+	std::vector<Event> eventCopy;
+	{
+		QMutexLocker locker(&ringListMutex);
+		for (auto& ring : ringList)
+		{
+			const quint64 written = ring.get()->written.load(std::memory_order_acquire);
+			const quint64 first = written > quint64(Ring::capacity) ? written - Ring::capacity : 0;
+			for (quint64 index = first; index < written; index++)
+			{
+				const Slot &slot = ring.get()->slotList[index % Ring::capacity];
+				const quint64 sequence = slot.sequence.load(std::memory_order_acquire);
+				if (sequence != index * 2 + 2)
+					continue;
+				const Event event{
+					slot.name.load(std::memory_order_relaxed),
+					slot.startNs.load(std::memory_order_relaxed),
+					slot.durationNs.load(std::memory_order_relaxed),
+					slot.threadIndex.load(std::memory_order_relaxed)
+				};
+				std::atomic_thread_fence(std::memory_order_acquire);
+				if (slot.sequence.load(std::memory_order_relaxed) == sequence && event.name)
+					eventCopy.push_back(event);
+			}
+		}
+	}
+
+	qint64 startFirst = eventCopy.empty() ? 0 : eventCopy.front().startNs;
+	for (auto& event : eventCopy)
+		startFirst = qMin(startFirst, event.startNs);
+
+	QJsonArray traceEvents;
+	for (auto& event : eventCopy)
+	{
+		QJsonObject traceEvent;
+		traceEvent["name"] = QString::fromLatin1(event.name);
+		traceEvent["ph"] = "X";
+		traceEvent["ts"] = double(event.startNs - startFirst) / 1000.0;
+		traceEvent["dur"] = double(event.durationNs) / 1000.0;
+		traceEvent["pid"] = int(QCoreApplication::applicationPid());
+		traceEvent["tid"] = event.threadIndex;
+		traceEvents.append(traceEvent);
+	}
+	QJsonObject root;
+	root["traceEvents"] = traceEvents;
+	root["displayTimeUnit"] = "ms";
+
+	QSaveFile file(path);
+	if (!file.open(QIODevice::WriteOnly))
+		return false;
+	file.write(QJsonDocument(root).toJson(QJsonDocument::Compact));
+	return file.commit();
+}
@@ -0,0 +1,58 @@
+/*
+This file is part of Photo Viewport.
+	Photo Viewport is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	Photo Viewport is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with Photo Viewport.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <atomic>
+#include <QString>
+
+// Lightweight timing of the hot paths (loading, decoding, scaling, sliding, painting), for finding out where the time goes
+// when something feels slow. A Trace::Scope placed at the top of a block records how long the block took.
+// Each thread records into its own fixed-size ring buffer, so recording never takes a lock or allocates,
+// and only the most recent events are kept. While tracing is off (the default), a scope costs one relaxed atomic load.
+// What's been recorded can be written out as Chrome trace-event JSON, for viewing in chrome://tracing or Perfetto.
+class Trace
+{
+public:
+	class Scope
+	{
+	public:
+		Scope(const char *name)
+			: name(Trace::enabled() ? name : nullptr), start(this->name ? Trace::now() : 0)
+		{
+		}
+
+		~Scope()
+		{
+			if (name)
+				Trace::record(name, start, Trace::now() - start);
+		}
+
+	private:
+		const char *name;
+		const qint64 start;
+	};
+
+	static bool enabled()
+	{
+		return active.load(std::memory_order_relaxed);
+	}
+
+	static void setEnabled(const bool enable);
+	static qint64 now();
+	static void record(const char *name, const qint64 startNs, const qint64 durationNs);
+	static bool exportChrome(const QString &path);
+
+private:
+	static std::atomic<bool> active;
+};
@@ -17,37 +17,43 @@ This file is part of Photo Viewport.
 Viewport::Viewport(QWidget* parent)
 	: QGraphicsView(parent)
 {
+	// Decoded images are held in a cache with a byte budget (see PixmapCache), so that
+	// loading a large number of photos doesn't keep every one of them decoded in memory at once.
+	// The budget can be adjusted in the settings file, for machines with more or less memory to spare.
+	QSettings settings;
+	pixmapCache.setByteBudget(settings.value("cache/budgetMB", pixmapCacheBudgetDefaultMB).toLongLong() * 1024 * 1024);
+	pixmapCache.setSlideEvictedHandler([=](quint64 contentId) { slideMappingRelease(contentId); });
+	prefetcher.setDownloadHandler([=](const Slide &slide) { slideDownloadStart(slide); });
+	prefetcher.setWindow(
+		settings.value("prefetch/ahead", prefetcher.windowAhead()).toInt(),
+		settings.value("prefetch/behind", prefetcher.windowBehind()).toInt()
+	);
+	networkLoader.get()->setInFlightMax(settings.value("network/inFlightMax", networkLoader.get()->inFlightMax()).toInt());
+	Trace::setEnabled(settings.value("trace/enabled", false).toBool());
+	zoomSettleTimer.setSingleShot(true);
+	zoomSettleTimer.setInterval(settings.value("zoom/settleMs", zoomSettleMsDefault).toInt());
+	wheelZooms = settings.value("zoom/wheel", wheelZooms).toBool();
+	zoomFits = settings.value("zoom/fit", zoomFits).toBool();
+	slideshowPlayer.setInterval(settings.value("slideshow/intervalMs", slideshowPlayer.interval()).toInt());
+	slideshowPlayer.setWaitMax(settings.value("slideshow/waitMaxMs", slideshowPlayer.waitMax()).toInt());
+	MappedFile::setMapBytesMin(settings.value("file/mapMinMB", MappedFile::mapBytesMin() / (1024 * 1024)).toLongLong() * 1024 * 1024);
+
 	// We account for if user is trying to open a file via the context menu / 
 	// double-clicking, without this program open.
-	// We do some basic checks, like making sure it's a supported image file, to avoid nonsense being loaded.
-	// Currently, we are not checking for multiple instances of the program running, so
-	// double-clicking images in this way over and over will create multiple instances of the program.
-	// It's probably better to leave multiple instances programming alone, to allow the user to have
-	// multiple instances with multiple different slideshows if they so desire.
+	// By default, double-clicking images in this way over and over will create multiple instances of the program,
+	// which allows the user to have multiple instances with multiple different slideshows if they so desire.
+	// In single-instance mode (see InstanceChannel), later launches hand their files over to this instance instead,
+	// and those come in through imgOpenFiles as well.
 	if (QApplication::arguments().size() > 1)
-	{
-		const QString filename = QApplication::arguments().at(1);
-		if (!filename.isEmpty())
-		{
-			QString urlExtension = extensionOf(filename);
-			if (urlExtension == ".jpg" ||
-				urlExtension == ".png" ||
-				urlExtension == ".bmp" ||
-				urlExtension == ".gif")
-			{
-				if (QFile::exists(filename))
-				{
-					imgApply(QPixmap(filename));
-					fileDirLastOpened = filename;
-				}
-			}
-		}
-	}
+		imgOpenFiles(QApplication::arguments().mid(1));
 
 	// Viewport and dependents' attributes (scene, item) are set on init inside viewport
 	// to minimize need for access from main window class.
 	setDragMode(QGraphicsView::ScrollHandDrag);
 	setAcceptDrops(true);
+	setTransformationAnchor(QGraphicsView::AnchorViewCenter);
+	setRenderHint(QPainter::SmoothPixmapTransform);
+	pixmapItem.get()->setTransformationMode(Qt::SmoothTransformation);
 	this->setStyleSheet("QGraphicsView{border: 0px; background-color: #000000;}");
 	this->setMinimumSize(QSize(this->width(), this->height() - 20));
 	this->setSizePolicy(QSizePolicy::Minimum, QSizePolicy::Minimum);
@@ -56,22 +62,47 @@ Viewport::Viewport(QWidget* parent)
 	graphicsScene.get()->addItem(pixmapItem.get());
 	actionFileOpen.get()->setObjectName("actionFileOpen");
 	actionFileOpen.get()->setText("Open Image");
+	actionFolderOpen.get()->setObjectName("actionFolderOpen");
+	actionFolderOpen.get()->setText("Open Folder");
 	actionPasteFromClipboard.get()->setObjectName("actionPasteFromClipboard");
 	actionPasteFromClipboard.get()->setText("Paste Image");
 	actionImageSave.get()->setObjectName("actionImageSave");
 	actionImageSave.get()->setText("Save Current Image");
+	actionExportAll.get()->setObjectName("actionExportAll");
+	actionExportAll.get()->setText("Export All Slides");
 	actionToggleAdjustToLastZoomLevel.get()->setObjectName("actionToggleAdjustToLastZoomLevel");
 	actionToggleAdjustToLastZoomLevel.get()->setText("Maintain Zoom Level on Slide");
 	actionToggleAdjustToLastZoomLevel.get()->setCheckable(true);
 	actionToggleAdjustToLastZoomLevel.get()->setChecked(true);
+	actionToggleSlideshow.get()->setObjectName("actionToggleSlideshow");
+	actionToggleSlideshow.get()->setText("Play Slideshow");
+	actionToggleSlideshow.get()->setCheckable(true);
+	actionToggleSlideshow.get()->setChecked(false);
+	actionToggleOverlay.get()->setObjectName("actionToggleOverlay");
+	actionToggleOverlay.get()->setText("Show Performance Overlay");
+	actionToggleOverlay.get()->setCheckable(true);
+	actionToggleOverlay.get()->setChecked(false);
+	actionToggleTrace.get()->setObjectName("actionToggleTrace");
+	actionToggleTrace.get()->setText("Record Trace");
+	actionToggleTrace.get()->setCheckable(true);
+	actionToggleTrace.get()->setChecked(Trace::enabled());
+	actionTraceExport.get()->setObjectName("actionTraceExport");
+	actionTraceExport.get()->setText("Export Trace");
 	contextMenu.get()->addAction(actionFileOpen.get());
+	contextMenu.get()->addAction(actionFolderOpen.get());
 	contextMenu.get()->addAction(actionPasteFromClipboard.get());
 	contextMenu.get()->addAction(actionImageSave.get());
+	contextMenu.get()->addAction(actionExportAll.get());
 	contextMenu.get()->addSeparator();
 	contextMenu.get()->addAction(actionToggleAdjustToLastZoomLevel.get());
+	contextMenu.get()->addAction(actionToggleSlideshow.get());
+	contextMenu.get()->addSeparator();
+	contextMenu.get()->addAction(actionToggleOverlay.get());
+	contextMenu.get()->addAction(actionToggleTrace.get());
+	contextMenu.get()->addAction(actionTraceExport.get());
 
-	// We allow the user to move left or right in the list of loaded images (stored as QPixmap variables and
-	// applied, in turn, to a single QGraphicsPixmapItem, swapping out its current QPixmap as we move),
+	// We allow the user to move left or right in the list of loaded images (stored as Slide entries, whose
+	// decoded QPixmap is applied, in turn, to a single QGraphicsPixmapItem, swapping out its current QPixmap as we move),
 	// thereby creating a slideshow effect.
 	// This location in the list is pushed to the end after a new image is loaded, 
 	// so that the order of images stays the same and display focus is placed on the new image when it's loaded.
@@ -99,15 +130,39 @@ Viewport::Viewport(QWidget* parent)
 		emit userDecreasedZoomLevel();
 	});
 	connect(shortcutZoomReset_Alt.get(), &QShortcut::activated, this, &Viewport::zoomReset);
+	connect(shortcutSlideshow.get(), &QShortcut::activated, actionToggleSlideshow.get(), &QAction::toggle);
 
 	connect(this, &Viewport::userIncreasedZoomLevel, this, [=]() { lastZoomLevel++; });
 	connect(this, &Viewport::userDecreasedZoomLevel, this, [=]() { lastZoomLevel--; });
 
-	connect(&netManager, SIGNAL(finished(QNetworkReply*)), this, SLOT(imgApplyFromNetwork(QNetworkReply*)));
+	connect(networkLoader.get(), &NetworkLoader::loaded, this, &Viewport::imgApplyFromNetwork);
+	connect(networkLoader.get(), &NetworkLoader::partialDecoded, this, &Viewport::slidePartialDecoded);
+	connect(networkLoader.get(), &NetworkLoader::progressed, this, [=](quint64 id) {
+		if (!slideList.empty() && slideList[slideListIndexCurrent].id == id)
+			this->viewport()->update();
+	});
+	connect(&decodePool, &DecodePool::decoded, this, &Viewport::slideDecoded);
+	connect(&folderScanner, &FolderScanner::found, this, &Viewport::folderEntriesFound);
+	connect(&folderScanner, &FolderScanner::finished, this, &Viewport::folderMerge);
+	connect(&zoomSettleTimer, &QTimer::timeout, this, &Viewport::zoomSettled);
+	connect(&zoomRefiner, &ZoomRefiner::refined, this, &Viewport::zoomRefined);
+	connect(&slideshowPlayer, &SlideshowPlayer::advanceDue, this, &Viewport::slideshowAdvance);
+	connect(&imageEncoder, &ImageEncoder::progressed, this, [=](quint64 batchId, int done, int total) {
+		Q_UNUSED(total);
+		if (exportProgress && batchId == exportBatchId)
+			exportProgress.get()->setValue(done);
+	});
+	connect(&imageEncoder, &ImageEncoder::finished, this, &Viewport::imgSaveFinished);
 
 	connect(actionFileOpen.get(), &QAction::triggered, this, &Viewport::imgOpenFromFile);
+	connect(actionFolderOpen.get(), &QAction::triggered, this, &Viewport::imgOpenFolder);
 	connect(actionPasteFromClipboard.get(), &QAction::triggered, this, &Viewport::imgPasteFromClipboard);
 	connect(actionImageSave.get(), &QAction::triggered, this, &Viewport::imgSaveCurrent);
+	connect(actionExportAll.get(), &QAction::triggered, this, &Viewport::imgExportAll);
+	connect(actionToggleSlideshow.get(), &QAction::toggled, this, &Viewport::slideshowToggled);
+	connect(actionToggleOverlay.get(), &QAction::toggled, this, [=]() { this->viewport()->update(); });
+	connect(actionToggleTrace.get(), &QAction::toggled, this, [=](bool checked) { Trace::setEnabled(checked); });
+	connect(actionTraceExport.get(), &QAction::triggered, this, &Viewport::traceExport);
 }
 
 // public
@@ -122,6 +177,109 @@ QGraphicsPixmapItem* Viewport::item()
 	return pixmapItem.get();
 }
 
+PixmapCache::Stats Viewport::pixmapCacheStats() const
+{
+	return pixmapCache.stats();
+}
+
+SlideshowPlayer::Stats Viewport::slideshowStats() const
+{
+	return slideshowPlayer.stats();
+}
+
+void Viewport::imgOpenFiles(const QStringList &filenameList)
+{
+	// We make sure each file is an image in a format we support (going by its contents, see DecoderRegistry), to avoid nonsense being loaded.
+	// A single image brings the rest of its folder in alongside it (see folderOpen), unless that's turned off in the settings file.
+	// Display focus goes to the first of the files, as when opening several from the file dialog.
+	QStringList filenameAccepted;
+	for (auto& filename : filenameList)
+	{
+		if (DecoderRegistry::isImageFile(filename))
+			filenameAccepted.append(filename);
+	}
+	if (filenameAccepted.isEmpty())
+		return;
+
+	if (filenameAccepted.size() == 1 && QSettings().value("folder/enabled", true).toBool())
+		folderOpen(QFileInfo(filenameAccepted.first()).absolutePath(), filenameAccepted.first());
+	else
+	{
+		bool focusNext = true;
+		for (auto& filename : filenameAccepted)
+		{
+			imgApply(Slide::fromFile(filename), focusNext);
+			focusNext = false;
+		}
+	}
+	fileDirLastOpened = filenameAccepted.last();
+}
+
+const std::vector<Slide>& Viewport::slides() const
+{
+	return slideList;
+}
+
+int Viewport::slideCurrentIndex() const
+{
+	return slideListIndexCurrent;
+}
+
+void Viewport::slideGoTo(const int index)
+{
+	// Moving to a slide goes through here whether it's a step left/right or a jump (e.g. from the filmstrip).
+	if (index < 0 || index >= int(slideList.size()) || index == slideListIndexCurrent)
+		return;
+
+	Trace::Scope trace("slide");
+
+	slideListIndexCurrent = index;
+	adjustToLastZoomLevel(actionToggleAdjustToLastZoomLevel.get()->isChecked() ? lastZoomLevel : 0);
+	slideDisplay(slideListIndexCurrent);
+	emit slideCurrentChanged(slideListIndexCurrent);
+}
+
+bool Viewport::sessionSave(const QString &filePath) const
+{
+	return SessionFile::save(filePath, slideList, sessionView());
+}
+
+bool Viewport::sessionRestore(const QString &filePath)
+{
+	// The restored slides go into the list as they are, and nothing is read for them here: only the slide the session was on
+	// is decoded before it's shown, and the rest wait until they're moved to or come within the prefetch window, as usual.
+	// Slides from the web are downloaded again (which the network cache mostly answers), but only the current slide's straight away;
+	// the rest are downloaded as they come within the prefetch window, so a big session doesn't queue up every one of them at once.
+	// The scroll position can only be put back once the current slide's size is known (see slideDisplay).
+	Trace::Scope trace("sessionRestore");
+	std::vector<Slide> slideListRestored;
+	SessionFile::View view;
+	if (!SessionFile::load(filePath, slideListRestored, view) || slideListRestored.empty())
+		return false;
+
+	const int indexFirst = int(slideList.size());
+	slideList.reserve(slideList.size() + slideListRestored.size());
+	for (auto& slide : slideListRestored)
+	{
+		slide.id = slideIdNext++;
+		slide.contentId = slideContentIdFor(slide);
+		slideList.push_back(std::move(slide));
+	}
+	slideListIndexCurrent = qBound(indexFirst, indexFirst + view.indexCurrent, int(slideList.size()) - 1);
+	const Slide &slideCurrent = slideList[slideListIndexCurrent];
+	if (slideCurrent.source == Slide::Source::Url && slideCurrent.data.isEmpty())
+		slideDownloadStart(slideCurrent);
+
+	lastZoomLevel = view.lastZoomLevel;
+	sessionCenter = view.center;
+	sessionCenterId = slideList[slideListIndexCurrent].id;
+	emit slideListChanged();
+	zoomApply(view.zoomLevel);
+	slideDisplay(slideListIndexCurrent);
+	emit slideCurrentChanged(slideListIndexCurrent);
+	return true;
+}
+
 
 // protected
 
@@ -142,41 +300,148 @@ void Viewport::dropEvent(QDropEvent *event)
 	{
 		// Presumably there are situations where the user could be dragging such that
 		// drag picks up image data, not just url location, so we account for that here.
-		imgApply(QPixmap::fromImage(qvariant_cast<QImage>(event->mimeData()->imageData())));
+		imgApply(Slide::fromImage(qvariant_cast<QImage>(event->mimeData()->imageData())));
 	}
 	else if (event->mimeData()->hasUrls())
+		imgOpenUrls(event->mimeData()->urls(), tr("Url Image Not Loaded"));
+}
+
+void Viewport::contextMenuEvent(QContextMenuEvent *event)
+{
+	contextMenu.get()->exec(event->globalPos());
+}
+
+void Viewport::drawForeground(QPainter *painter, const QRectF &rect)
+{
+	// The performance overlay shows how long the last paint and the last decode took, and how full the pixmap cache is.
+	// The paint time is from the frame before this one, since this one isn't finished yet.
+	// During slideshow playback, it also shows how many deadlines have been missed and how far off they've been.
+	if (actionToggleOverlay.get()->isChecked())
 	{
-		for (auto& mimeUrl : event->mimeData()->urls())
+		const PixmapCache::Stats stats = pixmapCache.stats();
+		QString overlay = tr("Frame: %1 ms\nDecode: %2 ms\nCache: %3 / %4 MB (%5 pixmaps)")
+			.arg(frameMsLast, 0, 'f', 2)
+			.arg(decodePool.decodeMsLast(), 0, 'f', 1)
+			.arg(stats.bytesUsed / (1024 * 1024))
+			.arg(stats.byteBudget / (1024 * 1024))
+			.arg(stats.count);
+		if (slideshowPlayer.isPlaying())
+		{
+			const SlideshowPlayer::Stats slideshow = slideshowPlayer.stats();
+			overlay += tr("\nSlideshow: %1 / %2 late (max %3 ms, jitter %4 ms), %5 not ready, %6 ahead")
+				.arg(slideshow.deadlinesMissed)
+				.arg(slideshow.advances)
+				.arg(slideshow.lateMsMax, 0, 'f', 1)
+				.arg(slideshow.jitterMsMean, 0, 'f', 1)
+				.arg(slideshow.advancesUnready)
+				.arg(slideshow.lookahead);
+		}
+		for (auto& format : DecoderRegistry::stats())
 		{
-			QString urlExtension = extensionOf(mimeUrl.toString());
-			if (urlExtension == ".jpg" ||
-				urlExtension == ".png" ||
-				urlExtension == ".bmp" ||
-				urlExtension == ".gif")
-			{
-				if (QFile::exists(mimeUrl.toLocalFile()))
-				{
-					// Assumption here is that user is dragging from local file "url".
-					imgApply(QPixmap(mimeUrl.toLocalFile()));
-				}
-				else
-				{
-					// Otherwise, we assume url is from the web and load it with network.
-					QNetworkRequest request(mimeUrl.toString());
-					netManager.get(request);
-				}
-			}
-			else
-			{
-				QMessageBox::information(this->parentWidget(), tr("Url Image Not Loaded"), tr("Url must end in supported image file extension (.jpg, .png, .gif, .bmp)\n\nIf you are dragging from the web, make sure you're dragging from an image link with a supported extension. In some cases, dragging from the web will give you an html link instead."));
-			}
+			overlay += tr("\n%1: %2 ms avg, %3 ms max (%4 decodes)")
+				.arg(QString(format.format).toUpper())
+				.arg(format.msTotal / format.decodes, 0, 'f', 1)
+				.arg(format.msMax, 0, 'f', 1)
+				.arg(format.decodes);
 		}
+		painter->save();
+		painter->resetTransform();
+		const QRect rectText = painter->fontMetrics().boundingRect(QRect(0, 0, 1000, 1000), Qt::AlignLeft | Qt::AlignTop, overlay).translated(8, 8);
+		painter->fillRect(rectText.adjusted(-4, -4, 4, 4), QColor(0, 0, 0, 160));
+		painter->setPen(Qt::green);
+		painter->drawText(rectText, Qt::AlignLeft | Qt::AlignTop, overlay);
+		painter->restore();
+	}
+
+	// While the current slide is still being downloaded or decoded, we let the user know something is on its way,
+	// rather than leaving them looking at an empty viewport. The same goes for an image that failed to download,
+	// or one we won't show at all (see TileSource).
+	if (slideList.empty())
+		return;
+
+	const quint64 id = slideList[slideListIndexCurrent].id;
+	QString status;
+	if (networkLoader.get()->isLoading(id))
+	{
+		const int percent = networkLoader.get()->progressPercent(id);
+		status = percent < 0 ? tr("Downloading...") : tr("Downloading... %1%").arg(percent);
+	}
+	else if (!tiledItem && pixmapItem.get()->pixmap().isNull() && decodePool.isPendingSlide(slideList[slideListIndexCurrent].contentId))
+		status = tr("Loading...");
+	else if (slideDownloadFailed.count(id))
+		status = tr("This image couldn't be downloaded.");
+	else if (tiledItem && !tiledItem.get()->isAvailable())
+		status = tr("This image is too large to show: its format can't be decoded a piece at a time.");
+
+	if (!status.isEmpty())
+	{
+		painter->save();
+		painter->resetTransform();
+		painter->setPen(Qt::gray);
+		painter->drawText(this->viewport()->rect(), Qt::AlignCenter, status);
+		painter->restore();
 	}
 }
 
-void Viewport::contextMenuEvent(QContextMenuEvent *event)
+void Viewport::paintEvent(QPaintEvent *event)
 {
-	contextMenu.get()->exec(event->globalPos());
+	// Always timed for the overlay, since reading a timer is all it costs.
+	Trace::Scope trace("paint");
+	QElapsedTimer timer;
+	timer.start();
+	QGraphicsView::paintEvent(event);
+	frameMsLast = timer.nsecsElapsed() / 1e6;
+}
+
+void Viewport::resizeEvent(QResizeEvent *event)
+{
+	// If slides are fitted to the viewport at zoom level 0 (see zoomScale), a resize can change both the scale and the pyramid level we want.
+	QGraphicsView::resizeEvent(event);
+	zoomTransformApply();
+	slidePyramidApply();
+	if (!slideList.empty() && !zoomSettleTimer.isActive())
+		prefetchUpdate(slideListIndexCurrent);
+}
+
+void Viewport::wheelEvent(QWheelEvent *event)
+{
+	// A plain wheel scrolls, as it does everywhere else; Ctrl+wheel zooms (or a plain wheel does too, if zoom/wheel is set).
+	// The wheel zooms in steps, the same as the keys do, keeping the point under the cursor where it is.
+	// Touchpads and free-spinning wheels send small deltas, which are saved up until they add up to a whole step (120 is one notch).
+	// The view would keep the center in place, so for the wheel we zoom without an anchor and scroll the point back under the cursor ourselves.
+	if (!wheelZooms && !(event->modifiers() & Qt::ControlModifier))
+	{
+		wheelAngleRemainder = 0;
+		QGraphicsView::wheelEvent(event);
+		return;
+	}
+	event->accept();
+	wheelAngleRemainder += event->angleDelta().y();
+	const int steps = wheelAngleRemainder / 120;
+	if (steps == 0)
+		return;
+	wheelAngleRemainder -= steps * 120;
+
+	// QWheelEvent::pos() is deprecated from Qt 5.14, where position() replaces it.
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+	const QPoint cursorPos = event->position().toPoint();
+#else
+	const QPoint cursorPos = event->pos();
+#endif
+	const QPointF scenePos = mapToScene(cursorPos);
+	setTransformationAnchor(QGraphicsView::NoAnchor);
+	zoomStep(steps);
+	setTransformationAnchor(QGraphicsView::AnchorViewCenter);
+	const QPoint offset = mapFromScene(scenePos) - cursorPos;
+	horizontalScrollBar()->setValue(horizontalScrollBar()->value() + offset.x());
+	verticalScrollBar()->setValue(verticalScrollBar()->value() + offset.y());
+	for (int step = 0; step < std::abs(steps); step++)
+	{
+		if (steps > 0)
+			emit userIncreasedZoomLevel();
+		else
+			emit userDecreasedZoomLevel();
+	}
 }
 
 
@@ -184,161 +449,778 @@ void Viewport::contextMenuEvent(QContextMenuEvent *event)
 
 void Viewport::adjustToLastZoomLevel(const int &zoomLevel)
 {
-	if (zoomLevel > 0)
-		for (int i = 0; i < zoomLevel; i++)
-			zoomIn();
-	else if (zoomLevel < 0)
-		for (int i = 0; i < abs(zoomLevel); i++)
-			zoomOut();
+	// Zoom is a view transform, so going to any zoom level is a single jump,
+	// regardless of how many zoom steps away from the native size it is.
+	zoomApply(zoomLevel);
 }
 
 void Viewport::slideLeft()
 {
-	if (pixmapListIndexCurrent - 1 >= 0)
-	{
-		pixmapItem.get()->setPixmap(pixmapList[pixmapListIndexCurrent - 1]);
-		graphicsScene.get()->setSceneRect(pixmapItem.get()->boundingRect());
-		pixmapListIndexCurrent--;
+	slideGoTo(slideListIndexCurrent - 1);
+}
+
+void Viewport::slideRight()
+{
+	slideGoTo(slideListIndexCurrent + 1);
+}
 
-		if (actionToggleAdjustToLastZoomLevel.get()->isChecked())
-			adjustToLastZoomLevel(lastZoomLevel);
+void Viewport::slideshowToggled(const bool checked)
+{
+	// Playback starts from the slide on screen. While it's playing, the prefetcher reaches as far ahead as the player wants.
+	if (checked)
+	{
+		slideshowPlayer.start();
+		prefetcher.setLookahead(slideshowPlayer.lookahead());
 	}
+	else
+	{
+		slideshowPlayer.stop();
+		prefetcher.setLookahead(0);
+	}
+	if (!slideList.empty())
+		prefetchUpdate(slideListIndexCurrent);
+	this->viewport()->update();
 }
 
-void Viewport::slideRight()
+void Viewport::slideshowAdvance()
 {
-	if (pixmapListIndexCurrent + 1 <= pixmapList.size() - 1)
+	// Called when an advance comes due, and again whenever a decode finishes while one is waiting.
+	// We only move on once the next slide is ready to be shown in full, so the viewport is never left empty mid-show;
+	// if it isn't, it's asked for again (in case it fell out of the cache) and the advance waits for it,
+	// up to a point: once the player says the advance is overdue, we move on regardless, and the player counts it.
+	// Playback stops at the last slide.
+	if (!slideshowPlayer.isDue())
+		return;
+	const int indexNext = slideListIndexCurrent + 1;
+	if (indexNext >= int(slideList.size()))
 	{
-		pixmapItem.get()->setPixmap(pixmapList[pixmapListIndexCurrent + 1]);
-		graphicsScene.get()->setSceneRect(pixmapItem.get()->boundingRect());
-		pixmapListIndexCurrent++;
+		actionToggleSlideshow.get()->setChecked(false);
+		return;
+	}
+	const bool ready = slideReady(indexNext);
+	if (!ready && !slideshowPlayer.isOverdue())
+	{
+		prefetchUpdate(slideListIndexCurrent);
+		return;
+	}
+
+	Trace::Scope trace("slideshowAdvance");
+	slideshowPlayer.advanced(ready);
+	prefetcher.setLookahead(slideshowPlayer.lookahead());
+	slideGoTo(indexNext);
+	if (actionToggleOverlay.get()->isChecked())
+		this->viewport()->update();
+}
 
-		if (actionToggleAdjustToLastZoomLevel.get()->isChecked())
-			adjustToLastZoomLevel(lastZoomLevel);
+bool Viewport::slideReady(const int index) const
+{
+	// Decoded at the level it'd be shown at or finer (tiled slides count once their size is known, see slideDecoded).
+	// A slide that can't be shown counts as ready too, since waiting won't change that: one whose download failed
+	// (it says so on screen, see drawForeground), and one that failed to decode (which is cached as an empty pixmap at level 0).
+	if (slideDownloadFailed.count(slideList[index].id))
+		return true;
+	const int level = slideLevelFor(index);
+	for (int levelCached = 0; levelCached <= level; levelCached++)
+	{
+		if (pixmapCache.contains(PixmapCache::keyOf(slideList[index].contentId, levelCached)))
+			return true;
 	}
+	return false;
 }
 
-void Viewport::zoomAdjustScrollPos(const double factorZoom)
+SessionFile::View Viewport::sessionView() const
 {
-	auto adjustScroll = [=](QScrollBar *scrollBar) {
-		scrollBar->setValue(int(
-			factorZoom * scrollBar->value() +
-			((factorZoom - 1) * scrollBar->pageStep() / 2)
-		));
-	};
+	// The scroll position is kept as the scene point in the middle of the view, which doesn't depend on the window's size.
+	SessionFile::View view;
+	view.indexCurrent = slideListIndexCurrent;
+	view.zoomLevel = zoomLevelCurrent;
+	view.lastZoomLevel = lastZoomLevel;
+	view.center = mapToScene(this->viewport()->rect().center());
+	return view;
+}
+
+double Viewport::zoomScale(const int zoomLevel, const int index) const
+{
+	// Zoom level 0 shows the slide at its native size, and each zoom step scales from there.
+	// If zoom/fit is set in the settings file, level 0 fits the slide into the viewport instead (images smaller than the viewport
+	// are left at their native size), so the scale depends on the slide as well as the zoom level.
+	return slideFitScale(index) * std::pow(factorZoomIn, zoomLevel);
+}
 
-	adjustScroll(this->horizontalScrollBar());
-	adjustScroll(this->verticalScrollBar());
+double Viewport::slideFitScale(const int index) const
+{
+	// Until we know how big the image is, it's taken to be shown at its native size.
+	if (!zoomFits || index < 0 || index >= int(slideList.size()))
+		return 1.0;
+	auto size = slideImageSize.find(slideList[index].contentId);
+	if (size == slideImageSize.end() || size->second.isEmpty())
+		return 1.0;
+	const QSize viewportSize = this->viewport()->size();
+	return qMin(1.0, qMin(double(viewportSize.width()) / size->second.width(), double(viewportSize.height()) / size->second.height()));
+}
+
+void Viewport::zoomTransformApply()
+{
+	// The fit changes with the slide and the viewport's size, as well as the zoom level.
+	const double scale = zoomScale(zoomLevelCurrent, slideListIndexCurrent);
+	if (transform() != QTransform::fromScale(scale, scale))
+		setTransform(QTransform::fromScale(scale, scale));
+}
+
+void Viewport::zoomApply(const int zoomLevel)
+{
+	// The scene is always laid out in the full resolution pixel coordinates of the current slide,
+	// and zooming only changes the view's transform. The view keeps whatever is in the center
+	// of the viewport in the center as the scale changes (see transformation anchor), so we don't need
+	// to adjust scroll position ourselves.
+	// While the user is still zooming (see zoomStep), prefetching waits until they settle on a level.
+	Trace::Scope trace("zoom");
+	zoomLevelCurrent = zoomLevel;
+	zoomTransformApply();
+	slidePyramidApply();
+	if (!slideList.empty() && !zoomSettleTimer.isActive())
+		prefetchUpdate(slideListIndexCurrent);
+}
+
+void Viewport::zoomStep(const int steps)
+{
+	// Held down keys auto-repeat, and wheels send bursts of events, so zooming by the user is done at preview quality:
+	// the view shows whatever pyramid level is already to hand, scaled with nearest neighbour filtering, and nothing is
+	// decoded or resampled along the way. Once no more zooming has come in for a moment, we settle on the level it ended at,
+	// which is the only one that gets decoded and rendered at full quality (see zoomSettled).
+	if (!zoomSettleTimer.isActive())
+	{
+		pixmapItem.get()->setTransformationMode(Qt::FastTransformation);
+		setRenderHint(QPainter::SmoothPixmapTransform, false);
+	}
+	zoomSettleTimer.start();
+	zoomApply(zoomLevelCurrent + steps);
+}
+
+void Viewport::zoomSettled()
+{
+	pixmapItem.get()->setTransformationMode(Qt::SmoothTransformation);
+	setRenderHint(QPainter::SmoothPixmapTransform, true);
+	slidePyramidApply();
+	if (!slideList.empty())
+		prefetchUpdate(slideListIndexCurrent);
+	this->viewport()->update();
 }
 
 void Viewport::zoomIn()
 {
-	QPixmap temp = pixmapList[pixmapListIndexCurrent].scaled(pixmapItem.get()->pixmap().size() * factorZoomIn, Qt::KeepAspectRatio, Qt::SmoothTransformation);
-	pixmapItem.get()->setPixmap(temp);
-	graphicsScene.get()->setSceneRect(pixmapItem.get()->boundingRect());
-	zoomAdjustScrollPos(factorZoomIn);
+	zoomStep(1);
 }
 
 void Viewport::zoomOut()
 {
-	QPixmap temp = pixmapList[pixmapListIndexCurrent].scaled(pixmapItem.get()->pixmap().size() * factorZoomOut, Qt::KeepAspectRatio, Qt::SmoothTransformation);
-	pixmapItem.get()->setPixmap(temp);
-	graphicsScene.get()->setSceneRect(pixmapItem.get()->boundingRect());
-	zoomAdjustScrollPos(factorZoomOut);
+	zoomStep(-1);
 }
 
 void Viewport::zoomReset()
 {
-	pixmapItem.get()->setPixmap(pixmapList[pixmapListIndexCurrent]);
-	graphicsScene.get()->setSceneRect(pixmapItem.get()->boundingRect());
+	zoomApply(0);
 	lastZoomLevel = 0;
 }
 
-QString Viewport::extensionOf(const QString str)
+void Viewport::zoomRefineRequest(const QPixmap &pixmap)
+{
+	// Zoomed out, the pixmap on the item is bigger than what's shown (by up to half again, or more while a finer level stands in),
+	// and the painter's bilinear filtering only looks at the four nearest pixels, so it aliases. So we have the resampler
+	// render it at exactly the size it's shown at, in the background, and swap that in when it's ready.
+	// Zoomed in, the painter is enlarging, which it does well enough on its own.
+	// If all we have is a coarser level standing in, we wait for the decode of the right one.
+	const quint64 id = slideList[slideListIndexCurrent].contentId;
+	if (pixmap.isNull() || (zoomRefinedId == id && zoomRefinedLevel == zoomLevelCurrent))
+		return;
+	auto size = slideImageSize.find(id);
+	const double scale = zoomScale(zoomLevelCurrent, slideListIndexCurrent);
+	if (size == slideImageSize.end() || scale >= 1.0)
+		return;
+	const QSize sizeShown(qMax(1, qRound(size->second.width() * scale)), qMax(1, qRound(size->second.height() * scale)));
+	if (pixmap.width() <= sizeShown.width() || pixmap.height() <= sizeShown.height())
+		return;
+
+	zoomRefinedId = id;
+	zoomRefinedLevel = zoomLevelCurrent;
+	zoomRefinedPixmap = QPixmap();
+	zoomRefiner.request(id, zoomLevelCurrent, pixmap.toImage(), sizeShown);
+}
+
+void Viewport::zoomRefined(const quint64 id, const int zoomLevel, const QImage &image)
+{
+	if (id != zoomRefinedId || zoomLevel != zoomRefinedLevel || image.isNull())
+		return;
+	zoomRefinedPixmap = QPixmap::fromImage(image);
+	slidePyramidApply();
+}
+
+int Viewport::slideIndexOf(const quint64 id) const
 {
-	// We look for a period to indicate the file has an extension.
-	// Then return the extension if it does.
-	// In theory, the extension should never return as something bonkers since we're looking for the last period.
-	// (And the last period should always be for an extension if the "url" has a period, or periods.)
-	if (str.lastIndexOf(".") == -1)
-		return QString();
+	// Slides are appended as they're loaded, so recently added ones (the usual case) are found quickest from the back.
+	for (int index = int(slideList.size()) - 1; index >= 0; index--)
+		if (slideList[index].id == id)
+			return index;
+	return -1;
+}
+
+quint64 Viewport::slideContentIdFor(const Slide &slide)
+{
+	// The first slide with a given content key lends its id as the content id for every slide after it with the same key.
+	// Slides without a key (a url that's still downloading) are only ever the same as themselves.
+	if (slide.contentKey.isEmpty())
+		return slide.id;
+	auto found = slideContentId.find(slide.contentKey);
+	if (found != slideContentId.end())
+		return found.value();
+	slideContentId.insert(slide.contentKey, slide.id);
+	return slide.id;
+}
+
+void Viewport::prefetchUpdate(const int index)
+{
+	// Each slide in the window is prefetched at its own level (see slideLevelFor), which is also the level slideReady checks for.
+	prefetcher.update(slideList, index, [this](int indexNear) { return slideLevelFor(indexNear); });
+}
+
+int Viewport::slideLevelFor(const int index) const
+{
+	// The smallest pyramid level that still has at least as many pixels as will be shown on screen,
+	// going by the scale the slide is actually shown at (see zoomScale). Neighbouring slides are prefetched
+	// for the scale they'll be shown at, which (if they're fitted to the viewport) is worked out for each of them in turn (see prefetchUpdate).
+	// If we don't know the image's size yet, the decode will sort out the clamping.
+	int level = 0;
+	const double scale = zoomScale(zoomLevelCurrent, index);
+	while (scale <= 1.0 / (1 << (level + 1)) && level < 16)
+		level++;
+
+	auto size = slideImageSize.find(slideList[index].contentId);
+	return size != slideImageSize.end() ? Slide::levelClamp(size->second, level) : level;
+}
+
+QPixmap Viewport::slidePyramidLevel(const int index, const int level, const bool decodeRequest)
+{
+	// Zoomed out views are drawn from a pyramid of pre-filtered levels (half size, quarter size, and so on),
+	// so the view only ever has to filter down by less than a factor of two, over the pixels actually visible.
+	// Nothing is scaled here, on the GUI thread: if the level isn't cached, the nearest finer level that is stands in for it
+	// (the zoom refiner renders that at the size shown, in the background), and failing that, the level is decoded in the background.
+	// Slides only remember where their image came from, so the decode is also how pixels that were evicted (or never decoded) come back.
+	// While a decode is on its way, we return the nearest coarser level we have, if any, so there's still something to show.
+	// Mid-zoom, we don't ask for decodes at all, since the level is likely to have changed again before they'd finish.
+	const quint64 id = slideList[index].contentId;
+	QPixmap pixmap;
+	if (pixmapCache.find(PixmapCache::keyOf(id, level), pixmap))
+		return pixmap;
+
+	for (int levelFiner = level - 1; levelFiner >= 0; levelFiner--)
+		if (pixmapCache.find(PixmapCache::keyOf(id, levelFiner), pixmap) && !pixmap.isNull())
+			return pixmap;
+
+	if (decodeRequest)
+		decodePool.request(slideList[index], level, index == slideListIndexCurrent ? 1 : 0);
+	for (int levelCoarser = level + 1; levelCoarser <= 16; levelCoarser++)
+		if (pixmapCache.find(PixmapCache::keyOf(id, levelCoarser), pixmap))
+			return pixmap;
+	return QPixmap();
+}
+
+void Viewport::slidePyramidApply()
+{
+	// We put whichever level we have for the current zoom on the item,
+	// and scale the item back up to full resolution coordinates, leaving the rest to the view transform.
+	// Since the scene stays in full resolution coordinates, swapping in a finer level later on
+	// (e.g. when a full resolution decode finishes after zooming in past the preview) leaves the scroll position as it was.
+	if (slideList.empty() || tiledItem)
+		return;
+
+	Trace::Scope trace("setPixmap");
+	// An animated slide shows whichever frame it's up to, at full resolution, once playback has started.
+	// Otherwise, a refined pixmap for this slide at this zoom level is used if there's one (see zoomRefineRequest);
+	// a refinement that's for anything else is out of date, and is dropped.
+	// A slide that's still downloading shows the preview of what has arrived so far.
+	const quint64 id = slideList[slideListIndexCurrent].contentId;
+	const bool zooming = zoomSettleTimer.isActive();
+	if (zoomRefinedId != id || zoomRefinedLevel != zoomLevelCurrent)
+	{
+		zoomRefiner.cancel();
+		zoomRefinedId = 0;
+		zoomRefinedPixmap = QPixmap();
+	}
+	QPixmap pixmapLevel = animationPlayer ? animationPlayer.get()->frame() : QPixmap();
+	if (pixmapLevel.isNull())
+		pixmapLevel = zoomRefinedPixmap;
+	if (pixmapLevel.isNull())
+	{
+		pixmapLevel = slidePyramidLevel(slideListIndexCurrent, slideLevelFor(slideListIndexCurrent), !zooming);
+		if (!zooming && !animationPlayer)
+			zoomRefineRequest(pixmapLevel);
+	}
+	if (pixmapLevel.isNull())
+	{
+		auto partial = slidePartialPixmap.find(slideList[slideListIndexCurrent].id);
+		if (partial != slidePartialPixmap.end())
+			pixmapLevel = partial->second;
+	}
+	pixmapItem.get()->setPixmap(pixmapLevel);
+	auto size = slideImageSize.find(id);
+	if (!pixmapLevel.isNull() && size != slideImageSize.end())
+	{
+		pixmapItem.get()->setTransform(QTransform::fromScale(
+			double(size->second.width()) / pixmapLevel.width(),
+			double(size->second.height()) / pixmapLevel.height()
+		));
+	}
+}
+
+void Viewport::slideAnimationUpdate(const int index)
+{
+	// Animations only play for the slide on screen; moving off one destroys its player, which stops it decoding.
+	// Whether a slide can be animated is found out by the decode worker (see slideDecoded), since it means opening the image;
+	// until the slide's first decode comes back, we don't know, and the slide is shown still. Once it does, it's displayed again.
+	const Slide &slide = slideList[index];
+	if (animationPlayer && animationPlayer.get()->slideId() == slide.id)
+		return;
+
+	animationPlayer.reset();
+	if (slide.source == Slide::Source::Url && slide.data.isEmpty())
+		return;
+	auto animated = slideAnimated.find(slide.contentId);
+	if (animated == slideAnimated.end() || !animated->second)
+		return;
+
+	animationPlayer = std::make_unique<AnimationPlayer>(slide);
+	connect(animationPlayer.get(), &AnimationPlayer::frameChanged, this, &Viewport::slidePyramidApply);
+	animationPlayer.get()->start();
+}
+
+void Viewport::slideDisplay(const int index)
+{
+	Trace::Scope trace("slideDisplay");
+	const quint64 id = slideList[index].contentId;
+	pixmapCache.pinSlide(id);
+
+	// Very large images are shown through a tiled item in place of the pixmap item.
+	auto size = slideImageSize.find(id);
+	if (size != slideImageSize.end() && TiledImageItem::wantsTiling(size->second))
+	{
+		animationPlayer.reset();
+		if (!tiledItem || tiledItem.get()->slideId() != id)
+		{
+			tiledItem = std::make_unique<TiledImageItem>(slideList[index], size->second);
+			graphicsScene.get()->addItem(tiledItem.get());
+		}
+		pixmapItem.get()->setPixmap(QPixmap());
+		graphicsScene.get()->setSceneRect(tiledItem.get()->boundingRect());
+		zoomTransformApply();
+	}
 	else
-		return QString(str.right(str.size() - str.lastIndexOf(".")));
+	{
+		tiledItem.reset();
+		{
+			Trace::Scope trace("setSceneRect");
+			graphicsScene.get()->setSceneRect(size != slideImageSize.end() ? QRectF(QPointF(0, 0), size->second) : QRectF());
+		}
+		zoomTransformApply();
+		slideAnimationUpdate(index);
+		slidePyramidApply();
+	}
+	if (sessionCenterId == slideList[index].id && size != slideImageSize.end())
+	{
+		centerOn(sessionCenter);
+		sessionCenterId = 0;
+	}
+	this->viewport()->update();
+	prefetchUpdate(index);
 }
 
-void Viewport::imgApply(const QPixmap &pixmap)
+void Viewport::slideDecoded(const quint64 decodedId, const int level, const QImage &image, const QSize &imageSize, const bool animated)
 {
-	// We use a generic function for adding an image as pixmap to the scene and adding it to images list.
+	// For tiled images, we still put an (empty) entry in the cache, so the slide counts as decoded
+	// and isn't asked for again; the tiled item takes care of its pixels from here on.
+	const quint64 id = slidePastedIdentify(decodedId);
+	if (imageSize.isValid())
+		slideImageSize[id] = imageSize;
+	slideAnimated[id] = animated;
+	if (TiledImageItem::wantsTiling(imageSize))
+		pixmapCache.insert(PixmapCache::keyOf(id, 0), QPixmap());
+	else
+		pixmapCache.insert(PixmapCache::keyOf(id, level), QPixmap::fromImage(image));
+	if (!slideList.empty() && slideList[slideListIndexCurrent].contentId == id)
+		slideDisplay(slideListIndexCurrent);
+	if (slideshowPlayer.isPlaying())
+	{
+		slideshowPlayer.decodeTimed(decodePool.decodeMsLast());
+		slideshowAdvance();
+	}
+}
+
+void Viewport::slideMappingRelease(const quint64 contentId)
+{
+	// Once none of a slide's pixels are cached, there's nothing to gain from keeping its file mapped until it's next decoded,
+	// and an open mapping holds the file open (see MappedFile).
+	for (Slide &slide : slideList)
+		if (slide.contentId == contentId && slide.mapped)
+			slide.mapped.get()->release();
+}
+
+quint64 Viewport::slidePastedIdentify(const quint64 contentId)
+{
+	// A pasted image only has a content key once a worker has compressed it (see Slide::pastedContentKey), which a decode
+	// of it has done by the time it comes back, so that's when the key is taken up. Until then the slide's content id is its own id.
+	// If it's an image we already have, the slide shares that one's content id from here on, and the decoded pixels go in under it.
+	auto pending = slidePastedPending.find(contentId);
+	if (pending == slidePastedPending.end())
+		return contentId;
+	const int index = slideIndexOf(contentId);
+	if (index == -1)
+	{
+		slidePastedPending.erase(pending);
+		return contentId;
+	}
+	Slide &slide = slideList[index];
+	slide.contentKey = slide.pastedContentKey();
+	if (slide.contentKey.isEmpty())
+		return contentId;
+	slidePastedPending.erase(pending);
+	slide.contentId = slideContentIdFor(slide);
+	if (slide.contentId != contentId)
+		slideImageSize.erase(contentId);
+	return slide.contentId;
+}
+
+void Viewport::slideDownloadStart(const Slide &slide)
+{
+	// Each slide's download is only started once, whether that's asked for when it's added, or by the prefetcher (see Prefetcher)
+	// every time it's in the window and still has no bytes. One that failed isn't tried again.
+	if (slideDownloadRequested.insert(slide.id).second)
+		networkLoader.get()->load(slide.id, slide.url);
+}
+
+void Viewport::slidePartialDecoded(const quint64 id, const QImage &image, const QSize &imageSize)
+{
+	// Downloads are tracked by slide id, and until a slide's bytes have all arrived, its content id is the same as its id.
+	slidePartialPixmap[id] = QPixmap::fromImage(image);
+	slideImageSize[id] = imageSize;
+	if (!slideList.empty() && slideList[slideListIndexCurrent].id == id)
+		slideDisplay(slideListIndexCurrent);
+}
+
+void Viewport::imgOpenUrls(const QList<QUrl> &urlList, const QString &titleRejected)
+{
+	// Dropped and pasted urls both come through here. A url to a local file is opened if the file's contents are an image
+	// we support, whatever it's called. Anything else, we assume is from the web and load with network,
+	// as long as it doesn't plainly point at something other than an image (see DecoderRegistry::isImageUrl).
+	// When several are given at once, display focus goes to the first of them,
+	// so the user sees something as soon as that one is decoded, and can slide through the rest in order.
+	bool focusNext = true;
+	bool rejected = false;
+	for (auto& url : urlList)
+	{
+		if (url.isLocalFile() && DecoderRegistry::isImageFile(url.toLocalFile()))
+			imgApply(Slide::fromFile(url.toLocalFile()), focusNext);
+		else if (!url.isLocalFile() && DecoderRegistry::isImageUrl(url))
+			imgLoadFromNetwork(url, focusNext);
+		else
+		{
+			rejected = true;
+			continue;
+		}
+		focusNext = false;
+	}
+	if (rejected)
+		QMessageBox::information(this->parentWidget(), titleRejected, tr("Url must be an image in a supported format (%1)\n\nIf you are dragging from the web, make sure you're dragging from an image link. In some cases, dragging from the web will give you an html link instead.").arg(DecoderRegistry::nameFilterList().join(", ")));
+}
+
+void Viewport::imgLoadFromNetwork(const QUrl &url, const bool focus)
+{
+	// The slide takes its place in the list straight away, so slides stay in the order they were dropped/pasted,
+	// regardless of which downloads finish first. Its bytes are filled in when the download completes.
+	// A url we've already downloaded this session is taken from the slide that has it, without going back to the network,
+	// and one that's still downloading is joined onto that download by the loader.
+	for (const Slide &slide : slideList)
+	{
+		if (slide.source == Slide::Source::Url && slide.url == url && !slide.data.isEmpty())
+		{
+			imgApply(Slide::fromNetwork(url, slide.data, slide.contentKey), focus);
+			return;
+		}
+	}
+	imgApply(Slide::fromNetwork(url, QByteArray()), focus);
+	slideDownloadStart(slideList.back());
+}
+
+void Viewport::imgApply(Slide slide, const bool focus)
+{
+	// We use a generic function for adding an image to the scene and adding it to images list.
 	// This should be the only place for general operations for adding to the scene.
 	// (e.g. the exception is operations that only apply to a specific image loading scenario,
 	// such as in reading data from network request.)
-	pixmapItem.get()->setPixmap(pixmap);
-	graphicsScene.get()->setSceneRect(pixmapItem.get()->boundingRect());
-	pixmapList.push_back(pixmap);
-	pixmapListIndexCurrent = pixmapList.size() - 1;
+	// The slide goes into the list right away, in the order it was given to us, and is decoded in the background
+	// when it's either displayed or comes within the prefetch window of the slide being displayed.
+	Trace::Scope trace("load");
+	slide.id = slideIdNext++;
+	slide.contentId = slideContentIdFor(slide);
+	if (slide.pasted)
+		slidePastedPending.insert(slide.id);
+	slideList.push_back(std::move(slide));
+	emit slideListChanged();
+	if (focus)
+	{
+		slideListIndexCurrent = slideList.size() - 1;
+		zoomApply(0);
+		slideDisplay(slideListIndexCurrent);
+		emit slideCurrentChanged(slideListIndexCurrent);
+	}
+	else
+		prefetchUpdate(slideListIndexCurrent);
+}
+
+void Viewport::folderOpen(const QString &dirPath, const QString &filename)
+{
+	// A folder's images take up a run of the slideshow, starting from wherever the end of it was when the folder was opened,
+	// and are kept sorted (by name, or date, per the settings file) as the scanner finds them (see FolderScanner).
+	// If we were given one of the folder's images, it goes up straight away, and the rest fill in around it;
+	// otherwise, the first image found goes up as soon as it's found. Nothing is decoded until it's displayed or prefetched.
+	// Anything still waiting to be merged from a folder opened before this one goes into that folder's run first.
+	folderMerge();
+	QSettings settings;
+	folderScanner.setSortOrder(settings.value("folder/sortBy", "name").toString() == "date" ? FolderScanner::SortOrder::Date : FolderScanner::SortOrder::Name);
+	folderBegin = int(slideList.size());
+	folderEntryList.clear();
+	folderFocusPending = filename.isEmpty();
+	if (!filename.isEmpty())
+	{
+		const QFileInfo fileInfo(filename);
+		FolderScanner::Entry entry;
+		entry.path = fileInfo.absoluteFilePath();
+		entry.name = fileInfo.fileName();
+		entry.size = fileInfo.size();
+		entry.modified = fileInfo.lastModified().toMSecsSinceEpoch();
+		folderEntryList.push_back(entry);
+		imgApply(Slide::fromFile(entry.path, entry.size, entry.modified));
+	}
+	folderScanner.scan(dirPath, filename);
+}
+
+void Viewport::folderEntriesFound(const std::vector<FolderScanner::Entry> &entryList)
+{
+	// Every merge goes through the whole of the folder's run of slides, so batches are held back and merged together
+	// rather than one at a time: once what's waiting is as big as what's already merged (which keeps the work done merging
+	// in proportion to the size of the folder), or once it has waited long enough to be worth showing, and when the scan is done.
+	// The very first entry goes straight in, so there's something to look at.
+	folderEntryPending.insert(folderEntryPending.end(), entryList.begin(), entryList.end());
+	if (folderEntryList.empty() || folderEntryPending.size() >= folderEntryList.size() || folderMergeTimer.hasExpired(folderMergeIntervalMs))
+		folderMerge();
+}
+
+void Viewport::folderMerge()
+{
+	// What's waiting is sorted, and merged into the folder's run of slides in a single pass, finding where each entry
+	// goes by binary search from where the one before it went. The slides come ready made from the scanner, and only need numbering.
+	// The slide on screen stays on screen, wherever it moves to; we keep track of it as we go, rather than looking for it afterwards.
+	folderMergeTimer.restart();
+	if (folderEntryPending.empty())
+		return;
+
+	Trace::Scope trace("folderMerge");
+	std::sort(folderEntryPending.begin(), folderEntryPending.end(),
+		[this](const FolderScanner::Entry &left, const FolderScanner::Entry &right) { return folderScanner.lessThan(left, right); }
+	);
+	const int folderEnd = folderBegin + int(folderEntryList.size());
+	int indexCurrent = slideListIndexCurrent < folderBegin ? slideListIndexCurrent : slideListIndexCurrent + int(folderEntryPending.size());
+	std::vector<Slide> slideListMerged;
+	std::vector<FolderScanner::Entry> entryListMerged;
+	slideListMerged.reserve(slideList.size() + folderEntryPending.size());
+	entryListMerged.reserve(folderEntryList.size() + folderEntryPending.size());
+
+	auto existingMove = [&](const size_t existing) {
+		if (folderBegin + int(existing) == slideListIndexCurrent)
+			indexCurrent = int(slideListMerged.size());
+		slideListMerged.push_back(std::move(slideList[folderBegin + existing]));
+		entryListMerged.push_back(std::move(folderEntryList[existing]));
+	};
+	for (int index = 0; index < folderBegin; index++)
+		slideListMerged.push_back(std::move(slideList[index]));
+	size_t existing = 0;
+	for (FolderScanner::Entry &entry : folderEntryPending)
+	{
+		const size_t position = std::upper_bound(folderEntryList.begin() + existing, folderEntryList.end(), entry,
+			[this](const FolderScanner::Entry &left, const FolderScanner::Entry &right) { return folderScanner.lessThan(left, right); }
+		) - folderEntryList.begin();
+		for (; existing < position; existing++)
+			existingMove(existing);
+		Slide slide = std::move(entry.slide);
+		entry.slide = Slide();
+		slide.id = slideIdNext++;
+		slide.contentId = slideContentIdFor(slide);
+		slideListMerged.push_back(std::move(slide));
+		entryListMerged.push_back(std::move(entry));
+	}
+	for (; existing < folderEntryList.size(); existing++)
+		existingMove(existing);
+	for (int index = folderEnd; index < int(slideList.size()); index++)
+		slideListMerged.push_back(std::move(slideList[index]));
+	slideList.swap(slideListMerged);
+	folderEntryList.swap(entryListMerged);
+	folderEntryPending.clear();
+
+	emit slideListChanged();
+	if (folderFocusPending)
+	{
+		folderFocusPending = false;
+		slideListIndexCurrent = folderBegin;
+		zoomApply(0);
+		slideDisplay(slideListIndexCurrent);
+	}
+	else
+	{
+		slideListIndexCurrent = qBound(0, indexCurrent, int(slideList.size()) - 1);
+		prefetchUpdate(slideListIndexCurrent);
+	}
+	emit slideCurrentChanged(slideListIndexCurrent);
+}
+
+QStringList Viewport::saveFilterList() const
+{
+	return QStringList{ tr("PNG Image (*.png)"), tr("JPEG Image (*.jpg)"), tr("BMP Image (*.bmp)") };
+}
+
+QByteArray Viewport::saveFormatOf(const QString &nameFilter) const
+{
+	if (nameFilter.contains("*.jpg"))
+		return "jpg";
+	else if (nameFilter.contains("*.bmp"))
+		return "bmp";
+	else
+		return "png";
+}
+
+int Viewport::saveQualityAsk(const QByteArray &format, bool &ok)
+{
+	// For JPEG, quality trades file size against how faithful the image is. PNG is always lossless,
+	// and there it trades file size against how long it takes to encode (lower is smaller, but slower).
+	// The last value used for each format is remembered for next time. BMP has no setting to ask about.
+	ok = true;
+	if (format == "bmp")
+		return -1;
+
+	QSettings settings;
+	const QString key = "save/quality_" + QString(format);
+	const int quality = QInputDialog::getInt(this, tr("Save Quality"),
+		format == "jpg" ? tr("JPEG quality (0-100):") : tr("PNG quality (0-100, lower compresses smaller but slower):"),
+		settings.value(key, format == "jpg" ? 90 : 50).toInt(), 0, 100, 1, &ok);
+	if (ok)
+		settings.setValue(key, quality);
+	return quality;
+}
+
+quint64 Viewport::imgSave(const QString &path, const QByteArray &format, const int quality)
+{
+	// If the slide is already decoded at full resolution, we hand over those pixels, rather than have them decoded again.
+	ImageEncoder::Job job;
+	job.slide = slideList[slideListIndexCurrent];
+	job.path = path;
+	job.format = format;
+	job.quality = quality;
+	QPixmap pixmap;
+	if (pixmapCache.find(PixmapCache::keyOf(job.slide.contentId, 0), pixmap))
+		job.image = pixmap.toImage();
+	return imageEncoder.submit({ job }, 1);
+}
+
+void Viewport::traceExport()
+{
+	const QString filename = QFileDialog::getSaveFileName(this, tr("Export Trace"), fileDirLastSaved, tr("Chrome Trace (*.json)"));
+	if (!filename.isEmpty() && !Trace::exportChrome(filename))
+		QMessageBox::information(this->parentWidget(), tr("Trace Not Exported"), tr("The trace could not be written."));
+}
+
+void Viewport::imgSaveFinished(const quint64 batchId, const int failed, const bool cancelled)
+{
+	if (exportProgress && batchId == exportBatchId)
+	{
+		exportProgress.reset();
+		if (!cancelled && failed > 0)
+			QMessageBox::information(this->parentWidget(), tr("Slides Not Exported"), tr("%1 of the slides could not be exported.").arg(failed));
+	}
+	else if (!cancelled && failed > 0)
+		QMessageBox::information(this->parentWidget(), tr("Image Not Saved"), tr("The image could not be saved."));
 }
 
 
 // private slots
 
-void Viewport::imgApplyFromNetwork(QNetworkReply *netReply)
+void Viewport::imgApplyFromNetwork(const quint64 id, const QByteArray &data, const QString &contentKey, const bool ok)
 {
-	QByteArray imgData = netReply->readAll();
-	netReply->deleteLater();
-	QPixmap newImg;
-	newImg.loadFromData(imgData);
-	imgApply(newImg);
+	// A failed download leaves the slide empty, and the slide is marked as failed, so the viewport says so
+	// instead of showing nothing at all (see drawForeground).
+	slidePartialPixmap.erase(id);
+	const int index = slideIndexOf(id);
+	if (index == -1)
+		return;
+	if (!ok)
+	{
+		slideDownloadFailed.insert(id);
+		slideImageSize.erase(id);
+	}
+
+	// Bytes that match a slide we already have (the same image from another url, say) share its decoded pixels from here on.
+	// The loader hashes the bytes for their content key before handing them over, so that isn't done here on the GUI thread.
+	Slide &slide = slideList[index];
+	slide.data = data;
+	if (!data.isEmpty())
+	{
+		slide.contentKey = contentKey;
+		slide.contentId = slideContentIdFor(slide);
+		if (slide.contentId != slide.id)
+			slideImageSize.erase(slide.id);
+	}
+	emit slideListChanged();
+	if (index == slideListIndexCurrent)
+		slideDisplay(index);
+	else
+		prefetchUpdate(slideListIndexCurrent);
+
+	// A slideshow may be waiting on this slide, which (if the download failed) now counts as ready without being decoded.
+	if (slideshowPlayer.isPlaying() && !ok)
+		slideshowAdvance();
 }
 
 void Viewport::imgOpenFromFile()
 {
-	QStringList filenameList = QFileDialog::getOpenFileNames(this, tr("Open"), fileDirLastOpened, tr("IMG Files (*.png *.gif *.jpg *.bmp)"));
+	QStringList filenameList = QFileDialog::getOpenFileNames(this, tr("Open"), fileDirLastOpened, tr("IMG Files (%1)").arg(DecoderRegistry::nameFilterList().join(' ')));
 	if (!filenameList.isEmpty())
 	{
+		bool focusNext = true;
 		for (auto& filename : filenameList)
 		{
-			imgApply(QPixmap(filename));
+			imgApply(Slide::fromFile(filename), focusNext);
+			focusNext = false;
 			fileDirLastOpened = filename;
 		}
 	}
 }
 
+void Viewport::imgOpenFolder()
+{
+	const QString dirPath = QFileDialog::getExistingDirectory(this, tr("Open Folder"), fileDirLastOpened);
+	if (!dirPath.isEmpty())
+	{
+		folderOpen(dirPath, QString());
+		fileDirLastOpened = dirPath;
+	}
+}
+
 void Viewport::imgPasteFromClipboard()
 {
 	// Clipboard support is especially useful in the case of web browsers, as dragging can be more difficult.
 	// With clipboard, the user can copy/paste the image data, rather than being concerned with the correct url.
 	if (QApplication::clipboard()->mimeData()->hasImage())
 	{
-		imgApply(QPixmap::fromImage(qvariant_cast<QImage>(QApplication::clipboard()->mimeData()->imageData())));
+		imgApply(Slide::fromImage(qvariant_cast<QImage>(QApplication::clipboard()->mimeData()->imageData())));
 	}
 	else if (QApplication::clipboard()->mimeData()->hasUrls())
-	{
-		for (auto& mimeUrl : QApplication::clipboard()->mimeData()->urls())
-		{
-			QString urlExtension = extensionOf(mimeUrl.toString());
-			if (urlExtension == ".jpg" ||
-				urlExtension == ".png" ||
-				urlExtension == ".bmp" ||
-				urlExtension == ".gif")
-			{
-				if (QFile::exists(mimeUrl.toLocalFile()))
-				{
-					// Assumption here is that user is copy/pasting from local file "url".
-					imgApply(QPixmap(mimeUrl.toLocalFile()));
-				}
-				else
-				{
-					// Otherwise, we assume url is from the web and load it with network.
-					QNetworkRequest request(mimeUrl.toString());
-					netManager.get(request);
-				}
-			}
-			else
-			{
-				QMessageBox::information(this->parentWidget(), tr("Url Image Not Copied"), tr("Url must end in supported image file extension (.jpg, .png, .gif, .bmp)\n\nIf you are dragging from the web, make sure you're dragging from an image link with a supported extension. In some cases, dragging from the web will give you an html link instead."));
-			}
-		}
-	}
+		imgOpenUrls(QApplication::clipboard()->mimeData()->urls(), tr("Url Image Not Copied"));
 	else
 		QMessageBox::information(this->parentWidget(), tr("Image Not Copied"), tr("No image found in the clipboard."));
 }
@@ -347,15 +1229,64 @@ void Viewport::imgSaveCurrent()
 {
 	// We allow the user to save the image they are currently on in the "slideshow."
 	// There are no editing capabilities in the program, so this is purely for saving something loaded in, as is.
-	QFileDialog dialog(this, tr("Save As"), fileDirLastSaved, tr("Image Files (*.png)"));
+	// Encoding happens in the background (see ImageEncoder), so the app stays responsive while a large image compresses.
+	if (slideList.empty())
+		return;
+
+	QFileDialog dialog(this, tr("Save As"), fileDirLastSaved, saveFilterList().join(";;"));
 	dialog.setWindowModality(Qt::WindowModal);
 	dialog.setAcceptMode(QFileDialog::AcceptSave);
 	if (dialog.exec() == QFileDialog::Accepted)
 	{
+		const QByteArray format = saveFormatOf(dialog.selectedNameFilter());
+		bool ok = false;
+		const int quality = saveQualityAsk(format, ok);
+		if (!ok)
+			return;
+
 		QString selectedFile = dialog.selectedFiles().first();
-		QFile fileWrite(selectedFile);
-		fileWrite.open(QIODevice::WriteOnly);
-		pixmapList[pixmapListIndexCurrent].save(&fileWrite, "PNG");
+		if (QFileInfo(selectedFile).suffix().isEmpty())
+			selectedFile += "." + QString(format);
+		imgSave(selectedFile, format, quality);
 		fileDirLastSaved = selectedFile;
 	}
+}
+
+void Viewport::imgExportAll()
+{
+	// Every slide is written out to a folder of the user's choosing, decoded and encoded in parallel in the background.
+	// Files are numbered in slideshow order (keeping the original name where there is one), so they sort the same way
+	// and can't collide with one another. Only one export runs at a time.
+	if (slideList.empty() || exportProgress)
+		return;
+
+	const QString dirExport = QFileDialog::getExistingDirectory(this, tr("Export All Slides"), fileDirLastSaved);
+	if (dirExport.isEmpty())
+		return;
+	bool ok = false;
+	const QByteArray format = saveFormatOf(QInputDialog::getItem(this, tr("Export Format"), tr("Format:"), saveFilterList(), 0, false, &ok));
+	if (!ok)
+		return;
+	const int quality = saveQualityAsk(format, ok);
+	if (!ok)
+		return;
+
+	std::vector<ImageEncoder::Job> jobList;
+	for (int index = 0; index < int(slideList.size()); index++)
+	{
+		ImageEncoder::Job job;
+		job.slide = slideList[index];
+		const QString nameBase = job.slide.source == Slide::Source::File ? QFileInfo(job.slide.path).completeBaseName() : QString("slide");
+		job.path = QDir(dirExport).filePath(QString("%1-%2.%3").arg(index + 1, 4, 10, QChar('0')).arg(nameBase).arg(QString(format)));
+		job.format = format;
+		job.quality = quality;
+		jobList.push_back(job);
+	}
+
+	exportProgress = std::make_unique<QProgressDialog>(tr("Exporting slides..."), tr("Cancel"), 0, int(jobList.size()), this);
+	exportProgress.get()->setMinimumDuration(0);
+	exportProgress.get()->setAutoClose(false);
+	exportBatchId = imageEncoder.submit(jobList);
+	connect(exportProgress.get(), &QProgressDialog::canceled, this, [=]() { imageEncoder.cancel(exportBatchId); });
+	fileDirLastSaved = dirExport;
 }
\ No newline at end of file
@@ -15,6 +15,10 @@ This file is part of Photo Viewport.
 #pragma once
 #include <memory>
 #include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <cmath>
+#include <algorithm>
 #include <QApplication>
 #include <QGraphicsView>
 #include <QGraphicsScene>
@@ -26,6 +30,7 @@ This file is part of Photo Viewport.
 #include <QDebug>
 #include <QFile>
 #include <QFileInfo>
+#include <QDateTime>
 #include <QNetworkAccessManager>
 #include <QNetworkRequest>
 #include <QNetworkReply>
@@ -34,36 +39,89 @@ This file is part of Photo Viewport.
 #include <QMessageBox>
 #include <QMenu>
 #include <QFileDialog>
+#include <QInputDialog>
+#include <QProgressDialog>
+#include <QDir>
 #include <QClipboard>
 #include <QScrollBar>
+#include <QSettings>
+#include <QStandardPaths>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QHash>
+#include <QWheelEvent>
+#include "Slide.h"
+#include "PixmapCache.h"
+#include "DecodePool.h"
+#include "Prefetcher.h"
+#include "TiledImageItem.h"
+#include "NetworkLoader.h"
+#include "AnimationPlayer.h"
+#include "ImageEncoder.h"
+#include "Trace.h"
+#include "FolderScanner.h"
+#include "Resampler.h"
+#include "ZoomRefiner.h"
+#include "SessionFile.h"
+#include "SlideshowPlayer.h"
+#include "DecoderRegistry.h"
 
 class Viewport : public QGraphicsView
 {
 	Q_OBJECT
+	friend class ViewportBenchmark;
 
 public:
 	Viewport(QWidget *parent = NULL);
 	QGraphicsScene* scene();
 	QGraphicsPixmapItem* item();
+	PixmapCache::Stats pixmapCacheStats() const;
+	SlideshowPlayer::Stats slideshowStats() const;
+	void imgOpenFiles(const QStringList &filenameList);
+	const std::vector<Slide>& slides() const;
+	int slideCurrentIndex() const;
+	void slideGoTo(const int index);
+	bool sessionSave(const QString &filePath) const;
+	bool sessionRestore(const QString &filePath);
 
 protected:
 	void dragEnterEvent(QDragEnterEvent *event) override;
 	void dragMoveEvent(QDragMoveEvent *event) override;
 	void dropEvent(QDropEvent *event) override;
 	void contextMenuEvent(QContextMenuEvent *event) override;
+	void drawForeground(QPainter *painter, const QRectF &rect) override;
+	void paintEvent(QPaintEvent *event) override;
+	void resizeEvent(QResizeEvent *event) override;
+	void wheelEvent(QWheelEvent *event) override;
 
 private:
 	QString fileDirLastOpened;
 	QString fileDirLastSaved;
 	std::unique_ptr<QMenu> contextMenu = std::make_unique<QMenu>();
 	std::unique_ptr<QAction> actionFileOpen = std::make_unique<QAction>();
+	std::unique_ptr<QAction> actionFolderOpen = std::make_unique<QAction>();
 	std::unique_ptr<QAction> actionPasteFromClipboard = std::make_unique<QAction>();
 	std::unique_ptr<QAction> actionImageSave = std::make_unique<QAction>();
+	std::unique_ptr<QAction> actionExportAll = std::make_unique<QAction>();
 	std::unique_ptr<QAction> actionToggleAdjustToLastZoomLevel = std::make_unique<QAction>();
-	std::vector<QPixmap> pixmapList;
-	int pixmapListIndexCurrent = 0;
+	std::unique_ptr<QAction> actionToggleSlideshow = std::make_unique<QAction>();
+	std::unique_ptr<QAction> actionToggleOverlay = std::make_unique<QAction>();
+	std::unique_ptr<QAction> actionToggleTrace = std::make_unique<QAction>();
+	std::unique_ptr<QAction> actionTraceExport = std::make_unique<QAction>();
+	std::vector<Slide> slideList;
+	int slideListIndexCurrent = 0;
+	quint64 slideIdNext = 1;
+	const qint64 pixmapCacheBudgetDefaultMB = 1024;
+	PixmapCache pixmapCache = PixmapCache(pixmapCacheBudgetDefaultMB * 1024 * 1024);
+	DecodePool decodePool;
+	Prefetcher prefetcher = Prefetcher(decodePool, pixmapCache);
 	std::unique_ptr<QGraphicsScene> graphicsScene = std::make_unique<QGraphicsScene>();
 	std::unique_ptr<QGraphicsPixmapItem> pixmapItem = std::make_unique<QGraphicsPixmapItem>();
+	std::unique_ptr<TiledImageItem> tiledItem;
+	std::unordered_map<quint64, QSize> slideImageSize;
+	QHash<QString, quint64> slideContentId;
+	std::unique_ptr<AnimationPlayer> animationPlayer;
+	std::unordered_map<quint64, bool> slideAnimated;
 	std::unique_ptr<QShortcut> shortcutSlideLeft = std::make_unique<QShortcut>(QKeySequence(tr("A", "Slide Left")), this);
 	std::unique_ptr<QShortcut> shortcutSlideRight = std::make_unique<QShortcut>(QKeySequence(tr("D", "Slide Right")), this);
 	std::unique_ptr<QShortcut> shortcutSlideLeft_Alt = std::make_unique<QShortcut>(QKeySequence(tr("Left", "Slide Left (Alt)")), this);
@@ -74,27 +132,93 @@ private:
 	std::unique_ptr<QShortcut> shortcutZoomIn_Alt = std::make_unique<QShortcut>(QKeySequence(tr("Up", "Zoom In")), this);
 	std::unique_ptr<QShortcut> shortcutZoomOut_Alt = std::make_unique<QShortcut>(QKeySequence(tr("Down", "Zoom Out")), this);
 	std::unique_ptr<QShortcut> shortcutZoomReset_Alt = std::make_unique<QShortcut>(QKeySequence(Qt::Key_0), this);
+	std::unique_ptr<QShortcut> shortcutSlideshow = std::make_unique<QShortcut>(QKeySequence(tr("Space", "Slideshow Play/Pause")), this);
 	const double factorZoomIn = 1.25;
-	const double factorZoomOut = 1 / factorZoomIn;
 	int lastZoomLevel = 0;
-	QNetworkAccessManager netManager;
+	int zoomLevelCurrent = 0;
+	QTimer zoomSettleTimer;
+	const int zoomSettleMsDefault = 150;
+	int wheelAngleRemainder = 0;
+	bool wheelZooms = false;
+	bool zoomFits = false;
+	ZoomRefiner zoomRefiner;
+	QPixmap zoomRefinedPixmap;
+	quint64 zoomRefinedId = 0;
+	int zoomRefinedLevel = 0;
+	std::unique_ptr<NetworkLoader> networkLoader = std::make_unique<NetworkLoader>(QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/network");
+	std::unordered_map<quint64, QPixmap> slidePartialPixmap;
+	std::unordered_set<quint64> slideDownloadFailed;
+	std::unordered_set<quint64> slidePastedPending;
+	std::unordered_set<quint64> slideDownloadRequested;
+	ImageEncoder imageEncoder;
+	std::unique_ptr<QProgressDialog> exportProgress;
+	quint64 exportBatchId = 0;
+	double frameMsLast = 0;
+	FolderScanner folderScanner;
+	std::vector<FolderScanner::Entry> folderEntryList;
+	std::vector<FolderScanner::Entry> folderEntryPending;
+	QElapsedTimer folderMergeTimer;
+	const qint64 folderMergeIntervalMs = 250;
+	int folderBegin = 0;
+	bool folderFocusPending = false;
+	SlideshowPlayer slideshowPlayer;
+	QPointF sessionCenter;
+	quint64 sessionCenterId = 0;
 	void slideLeft();
 	void slideRight();
+	SessionFile::View sessionView() const;
+	void slideshowToggled(const bool checked);
+	void slideshowAdvance();
+	bool slideReady(const int index) const;
 	void adjustToLastZoomLevel(const int &zoomLevel);
-	void zoomAdjustScrollPos(const double factorZoom);
+	double zoomScale(const int zoomLevel, const int index) const;
+	double slideFitScale(const int index) const;
+	void zoomTransformApply();
+	void zoomApply(const int zoomLevel);
+	void zoomStep(const int steps);
+	void zoomSettled();
 	void zoomIn();
 	void zoomOut();
 	void zoomReset();
-	QString extensionOf(const QString str);
-	void imgApply(const QPixmap &pixmap);
+	void zoomRefineRequest(const QPixmap &pixmap);
+	void zoomRefined(const quint64 id, const int zoomLevel, const QImage &image);
+	int slideIndexOf(const quint64 id) const;
+	quint64 slideContentIdFor(const Slide &slide);
+	void prefetchUpdate(const int index);
+	int slideLevelFor(const int index) const;
+	QPixmap slidePyramidLevel(const int index, const int level, const bool decodeRequest = true);
+	void slidePyramidApply();
+	void slideAnimationUpdate(const int index);
+	void slideDisplay(const int index);
+	void slideDecoded(const quint64 id, const int level, const QImage &image, const QSize &imageSize, const bool animated);
+	void slideMappingRelease(const quint64 contentId);
+	quint64 slidePastedIdentify(const quint64 contentId);
+	void slideDownloadStart(const Slide &slide);
+	void slidePartialDecoded(const quint64 id, const QImage &image, const QSize &imageSize);
+	void imgOpenUrls(const QList<QUrl> &urlList, const QString &titleRejected);
+	void imgLoadFromNetwork(const QUrl &url, const bool focus);
+	void imgApply(Slide slide, const bool focus = true);
+	void folderOpen(const QString &dirPath, const QString &filename);
+	void folderEntriesFound(const std::vector<FolderScanner::Entry> &entryList);
+	void folderMerge();
+	QStringList saveFilterList() const;
+	QByteArray saveFormatOf(const QString &nameFilter) const;
+	int saveQualityAsk(const QByteArray &format, bool &ok);
+	quint64 imgSave(const QString &path, const QByteArray &format, const int quality);
+	void imgSaveFinished(const quint64 batchId, const int failed, const bool cancelled);
 
 signals:
 	void userIncreasedZoomLevel();
 	void userDecreasedZoomLevel();
+	void slideListChanged();
+	void slideCurrentChanged(int index);
 
 private slots:
-	void imgApplyFromNetwork(QNetworkReply *netReply);
+	void imgApplyFromNetwork(const quint64 id, const QByteArray &data, const QString &contentKey, const bool ok);
 	void imgOpenFromFile();
+	void imgOpenFolder();
 	void imgPasteFromClipboard();
 	void imgSaveCurrent();
+	void imgExportAll();
+	void traceExport();
 };
\ No newline at end of file
@@ -0,0 +1,99 @@
+/*
+This file is part of Photo Viewport.
+	Photo Viewport is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	Photo Viewport is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with Photo Viewport.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "ZoomRefiner.h"
+
+class ZoomRefiner::Task : public QRunnable
+{
+public:
+	Task(ZoomRefiner *refiner, const quint64 id, const int zoomLevel, const QImage &image, const QSize &size)
+		: refiner(refiner), id(id), zoomLevel(zoomLevel), image(image), size(size)
+	{
+		// As with decoding, the refiner deletes tasks once their result is back on the GUI thread,
+		// so a task pointer is always safe to take back out of the queue or compare against.
+		setAutoDelete(false);
+	}
+
+	void run() override
+	{
+		Trace::Scope trace("refine");
+		const QImage imageRefined = Resampler::scaled(image, size);
+		ZoomRefiner *refinerTarget = refiner;
+		Task *task = this;
+		QMetaObject::invokeMethod(refiner, [refinerTarget, task, imageRefined]() {
+			refinerTarget->taskFinished(task, imageRefined);
+		}, Qt::QueuedConnection);
+	}
+
+	ZoomRefiner *refiner;
+	quint64 id;
+	int zoomLevel;
+	QImage image;
+	QSize size;
+};
+
+ZoomRefiner::ZoomRefiner(QObject *parent)
+	: QObject(parent)
+{
+	// One refinement at a time is plenty, since only the latest is ever wanted,
+	// and the resampler already spreads a single image across the cores.
+	threadPool.setMaxThreadCount(1);
+}
+
+ZoomRefiner::~ZoomRefiner()
+{
+	threadPool.clear();
+	threadPool.waitForDone();
+	for (Task *task : taskList)
+		delete task;
+}
+
+void ZoomRefiner::request(const quint64 id, const int zoomLevel, const QImage &image, const QSize &size)
+{
+	cancel();
+	taskPending = new Task(this, id, zoomLevel, image, size);
+	taskList.insert(taskPending);
+	threadPool.start(taskPending);
+}
+
+void ZoomRefiner::cancel()
+{
+	// A task that's already running can't be stopped, so it's left to finish and its result is thrown away
+	// when it arrives, since it's no longer the pending one.
+	if (taskPending && threadPool.tryTake(taskPending))
+	{
+		taskList.erase(taskPending);
+		delete taskPending;
+	}
+	taskPending = nullptr;
+}
+
+bool ZoomRefiner::isPending() const
+{
+	return taskPending != nullptr;
+}
+
+void ZoomRefiner::taskFinished(Task *task, const QImage &image)
+{
+	const bool current = task == taskPending;
+	const quint64 id = task->id;
+	const int zoomLevel = task->zoomLevel;
+	taskList.erase(task);
+	delete task;
+	if (!current)
+		return;
+
+	taskPending = nullptr;
+	emit refined(id, zoomLevel, image);
+}
@@ -0,0 +1,48 @@
+/*
+This file is part of Photo Viewport.
+	Photo Viewport is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	Photo Viewport is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with Photo Viewport.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <unordered_set>
+#include <QObject>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QImage>
+#include "Resampler.h"
+#include "Trace.h"
+
+// Renders the slide on screen at exactly the size it's shown at, off the GUI thread, once zooming has settled.
+// Until then, the view makes do with the nearest pyramid level it has, which the painter scales on the fly.
+// Only the latest request matters: asking again takes back a request that hasn't started,
+// and the result of one that has is dropped when it arrives, since the view has moved on.
+class ZoomRefiner : public QObject
+{
+	Q_OBJECT
+
+public:
+	ZoomRefiner(QObject *parent = Q_NULLPTR);
+	~ZoomRefiner();
+	void request(const quint64 id, const int zoomLevel, const QImage &image, const QSize &size);
+	void cancel();
+	bool isPending() const;
+
+signals:
+	void refined(quint64 id, int zoomLevel, QImage image);
+
+private:
+	class Task;
+	QThreadPool threadPool;
+	std::unordered_set<Task*> taskList;
+	Task *taskPending = nullptr;
+	void taskFinished(Task *task, const QImage &image);
+};
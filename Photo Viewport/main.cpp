@@ -13,13 +13,57 @@ This file is part of Photo Viewport.
 */
 
 #include "PhotoViewport.h"
+#include "InstanceChannel.h"
 #include <QtWidgets/QApplication>
+#include <memory>
+#include <QFileInfo>
+#include <QSettings>
+#include <QLockFile>
 
 int main(int argc, char *argv[])
 {
+	// In single-instance mode (off by default, see the settings file), a launch with files to open first tries handing them
+	// to the instance that's already running, and exits if it can. This is done with a bare QCoreApplication,
+	// before any of the GUI is started, so the handoff is over in milliseconds. If no instance answers, we start up as usual,
+	// and listen for the launches that come after us.
+	// Everything from the handoff to listening is done holding the startup lock (see InstanceChannel), so launches made
+	// at the same moment (e.g. opening several files at once from a file manager) take turns, and all but the first hand off.
+	// The lock is only waited on for so long; if it's held by a launch that's stuck, we go ahead without it.
+	QCoreApplication::setOrganizationName("Photo Viewport");
+	QCoreApplication::setApplicationName("Photo Viewport");
+	const bool singleInstance = QSettings().value("instance/single", false).toBool();
+	std::unique_ptr<QLockFile> instanceLock;
+	QStringList fileList;
+	if (singleInstance)
+	{
+		instanceLock = std::make_unique<QLockFile>(InstanceChannel::lockPath());
+		instanceLock.get()->setStaleLockTime(0);
+		instanceLock.get()->tryLock(5000);
+	}
+	if (singleInstance && argc > 1)
+	{
+		QCoreApplication handOffApp(argc, argv);
+		for (auto& argument : handOffApp.arguments().mid(1))
+			fileList.append(QFileInfo(argument).absoluteFilePath());
+		if (InstanceChannel::handOff(fileList))
+			return 0;
+	}
+
 	QApplication a(argc, argv);
+	a.setOrganizationName("Photo Viewport");
+	a.setApplicationName("Photo Viewport");
 	a.setWindowIcon(QIcon(":/PhotoViewport/Icon/photo-viewport-icon.ico"));
 	PhotoViewport w;
+	InstanceChannel instanceChannel;
+	if (singleInstance)
+	{
+		// If another instance is listening by now, our files go to it after all.
+		if (instanceChannel.listen())
+			QObject::connect(&instanceChannel, &InstanceChannel::filesReceived, &w, &PhotoViewport::filesOpen);
+		else if (!fileList.isEmpty() && InstanceChannel::handOff(fileList))
+			return 0;
+		instanceLock.reset();
+	}
 	w.show();
 	return a.exec();
 }